@@ -0,0 +1,230 @@
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include "ranker.cpp"
+
+// Micro-benchmarks over an already built index, run from main() with --bench.
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static double elapsed_ms(bench_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - since).count();
+}
+
+// Multi-term queries led by one of the most frequent terms, the case where
+// nearly every document becomes a candidate, plus up to three terms drawn
+// from the wider head of the vocabulary.
+template <class ranker_t>
+static std::vector<std::vector<term>> make_bench_queries(ranker_t& ranker, size_t vocabulary_size, size_t count) {
+	std::vector<term> by_frequency;
+	for (size_t t = 0; t < vocabulary_size; ++t) {
+		if (ranker.document_frequency((term)t) != 0) by_frequency.push_back((term)t);
+	}
+	std::sort(by_frequency.begin(), by_frequency.end(), [&](term a, term b) {
+		size_t fa = ranker.document_frequency(a), fb = ranker.document_frequency(b);
+		return fa > fb || (fa == fb && a < b);
+	});
+	if (by_frequency.size() > 4096) by_frequency.resize(4096);
+	const size_t broad = std::min<size_t>(by_frequency.size(), 64);
+
+	std::vector<std::vector<term>> queries;
+	if (by_frequency.empty()) return queries;
+
+	std::mt19937 rng(42);
+	for (size_t q = 0; q < count; ++q) {
+		std::vector<term> query;
+		size_t length = 1 + rng() % 4;
+		query.push_back(by_frequency[rng() % broad]);
+		for (size_t i = 1; i < length; ++i) query.push_back(by_frequency[rng() % by_frequency.size()]);
+		queries.push_back(query);
+	}
+	return queries;
+}
+
+// ranker_t is search_ranker or anything with its rank_tokens() and
+// document_frequency()
+template <class ranker_t>
+void bench_retrieval(ranker_t& ranker, const term_dictionary& dictionary, size_t top_results_count) {
+	const auto queries = make_bench_queries(ranker, dictionary.size(), 500);
+	if (queries.empty()) return;
+
+	const retrieval_mode modes[] = { retrieval_mode::exhaustive, retrieval_mode::wand, retrieval_mode::block_max_wand };
+	const char* names[] = { "exhaustive", "wand", "block-max wand" };
+
+	std::vector<std::vector<score_pair>> reference;
+	printf("Retrieval benchmark: %zu queries, top-%zu\n", queries.size(), top_results_count);
+	for (size_t m = 0; m < 3; ++m) {
+		std::vector<std::vector<score_pair>> results;
+		results.reserve(queries.size());
+		auto t_before = bench_clock::now();
+		for (const auto& q : queries) {
+			results.push_back(ranker.rank_tokens(q, top_results_count, modes[m]));
+		}
+		double t_delta = elapsed_ms(t_before);
+
+		if (m == 0) reference = results;
+		printf("  %-15s %10.3f ms  %s\n", names[m], t_delta,
+			m == 0 ? "" : (results == reference ? "(same top-k)" : "(TOP-K DIFFERS)"));
+	}
+}
+
+// Cost of publishing a one-document edit, a removal and an add, while a
+// segmented index grows from docs a batch at a time: it should follow the
+// size of the edit, not the number of documents or segments. index_t is
+// segmented_index, empty and with its segment files in a scratch place.
+template <class index_t>
+void bench_commits(index_t& index, doc_list& docs) {
+	if (docs.empty()) return;
+	const size_t batch = std::max<size_t>(1, docs.size() / 16);
+	// position in docs of the document behind every id handed out
+	std::vector<size_t> doc_of;
+	printf("Commit benchmark: one edit after every %zu documents added\n", batch);
+	size_t next = 0;
+	for (size_t round = 0; next < docs.size(); ++round) {
+		for (const size_t end = std::min(docs.size(), next + batch); next < end; ++next) {
+			index.add(*docs[next]);
+			doc_of.push_back(next);
+		}
+		index.commit(true);
+
+		// the edit replaces the document with id round
+		const doc_t& edited = *docs[doc_of[round]];
+		auto t_before = bench_clock::now();
+		index.remove((doc_id)round, edited.get_terms());
+		index.add(edited);
+		index.commit();
+		double t_delta = elapsed_ms(t_before);
+		doc_of.push_back(doc_of[round]);
+		printf("  %8zu documents %3zu segments  commit %8.3f ms\n", doc_of.size(), index.segment_count(), t_delta);
+	}
+}
+
+// Index size and full-scan decode throughput of every postings codec.
+void bench_codecs(doc_list& docs, const term_dictionary& dictionary) {
+	std::vector<const std::vector<term_count>*> terms;
+	for (size_t d = 0; d < docs.size(); ++d) terms.push_back(&docs[d]->get_terms());
+
+	const postings_codec codecs[] = { postings_codec::raw, postings_codec::varint, postings_codec::pfor };
+	const char* names[] = { "raw", "varint", "pfor" };
+
+	printf("Postings codec benchmark\n");
+	for (size_t c = 0; c < 3; ++c) {
+		postings_index index;
+		index.set_codec(codecs[c]);
+		auto t_before = bench_clock::now();
+		index.build(terms, dictionary.size(), [](uint32_t tf) { return (float)tf; });
+		double t_build = elapsed_ms(t_before);
+
+		size_t postings = 0;
+		uint64_t checksum = 0;
+		const int rounds = 5;
+		t_before = bench_clock::now();
+		for (int r = 0; r < rounds; ++r) {
+			for (size_t t = 0; t < dictionary.size(); ++t) {
+				index.scan((term_id)t, [&](doc_id d, float) { checksum += d; ++postings; });
+			}
+		}
+		double t_decode = elapsed_ms(t_before);
+
+		const size_t bytes = index.get_doc_id_bytes();
+		printf("  %-7s doc ids %10zu bytes (%5.2f bits/posting)  build %8.3f ms  decode %8.1f M postings/s  [%llu]\n",
+			names[c], bytes, postings == 0 ? 0.0 : 8.0 * bytes * rounds / postings, t_build,
+			t_decode == 0.0 ? 0.0 : postings / t_decode / 1000.0, (unsigned long long)checksum);
+	}
+}
+
+// Stemming throughput over the tokens of the indexed files, repeated until
+// at least a million words have been stemmed.
+void bench_stemmer(doc_list& docs) {
+	std::vector<std::string> words;
+	size_t longest = 0;
+	for (size_t d = 0; d < docs.size(); ++d) {
+		std::ifstream in(docs[d]->get_path(), std::ios::binary);
+		std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		for (auto& t : tokenize(text)) {
+			longest = std::max(longest, t.size());
+			words.push_back(std::move(t));
+		}
+	}
+	if (words.empty()) return;
+
+	std::vector<char> buffer(longest + 1);
+	const size_t rounds = 1 + 1000000 / words.size();
+	stem_cache cache;
+	const char* names[] = { "porter", "cached" };
+	printf("Stemmer benchmark: %zu words x %zu rounds\n", words.size(), rounds);
+	for (int cached = 0; cached < 2; ++cached) {
+		size_t letters = 0;
+		auto t_before = bench_clock::now();
+		for (size_t r = 0; r < rounds; ++r) {
+			for (const auto& w : words) {
+				std::memcpy(buffer.data(), w.data(), w.size());
+				letters += cached ? cache.stem(buffer.data(), w.size()) : porter::stem(buffer.data(), w.size());
+			}
+		}
+		double t_delta = elapsed_ms(t_before);
+
+		printf("  %-7s %10.3f ms  %8.2f M words/s  [%zu]\n", names[cached], t_delta,
+			t_delta == 0.0 ? 0.0 : words.size() * rounds / t_delta / 1000.0, letters);
+	}
+	printf("  cache hit rate %.2f%%\n", 100.0 * cache.stats().hit_rate());
+}
+
+// Token boundary detection and lower-casing throughput of every scanner
+// the CPU supports, checked against tokenize().
+void bench_tokenizer(doc_list& docs) {
+	std::vector<std::string> texts;
+	size_t bytes = 0;
+	for (size_t d = 0; d < docs.size(); ++d) {
+		std::ifstream in(docs[d]->get_path(), std::ios::binary);
+		texts.emplace_back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		bytes += texts.back().size();
+	}
+	if (bytes == 0) return;
+
+	auto token_hash = [](uint64_t h, const char* w, size_t n) {
+		for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)w[i]) * 0x100000001b3ull;
+		return (h ^ 0xff) * 0x100000001b3ull;
+	};
+
+	size_t expected_tokens = 0;
+	uint64_t expected = 0;
+	auto t_before = bench_clock::now();
+	for (const auto& text : texts) {
+		for (const auto& t : tokenize(text)) {
+			expected = token_hash(expected, t.data(), t.size());
+			++expected_tokens;
+		}
+	}
+	double t_delta = elapsed_ms(t_before);
+
+	const size_t rounds = 1 + (64u << 20) / bytes;
+	printf("Tokenizer benchmark: %.2f MB x %zu rounds, %zu tokens\n", bytes / 1048576.0, rounds, expected_tokens);
+	printf("  %-9s %10.3f ms  %8.1f MB/s\n", "tokenize", t_delta, t_delta == 0.0 ? 0.0 : bytes / 1048576.0 / (t_delta / 1000.0));
+
+	std::string scratch(64, '\0');
+	for (const auto& scanner : available_scanners()) {
+		size_t tokens = 0, letters = 0;
+		t_before = bench_clock::now();
+		for (size_t r = 0; r < rounds; ++r) {
+			for (const auto& text : texts) {
+				for_each_token(text.data(), text.size(), scanner.scan, scratch, [&](char*, size_t n, size_t) {
+					letters += n;
+					++tokens;
+				});
+			}
+		}
+		t_delta = elapsed_ms(t_before);
+
+		// checked outside the timed loop
+		uint64_t hash = 0;
+		for (const auto& text : texts) {
+			for_each_token(text.data(), text.size(), scanner.scan, scratch, [&](char* w, size_t n, size_t) { hash = token_hash(hash, w, n); });
+		}
+		printf("  %-9s %10.3f ms  %8.1f MB/s  %s\n", scanner.name, t_delta,
+			t_delta == 0.0 ? 0.0 : bytes * rounds / 1048576.0 / (t_delta / 1000.0),
+			tokens == expected_tokens * rounds && hash == expected ? "(same tokens)" : "(TOKENS DIFFER)");
+	}
+}
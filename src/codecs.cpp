@@ -0,0 +1,139 @@
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Integer codecs for blocks of document-id gaps.
+//
+// varint: 7 data bits per byte, high bit set on every byte but the last.
+// pfor:   patched frame of reference. A block is written as a bit width b,
+//         the count of exceptions, every value's low b bits packed
+//         back to back, then for each exception (a value that does not fit
+//         in b bits) its position and its remaining high bits as a varint.
+//         b is chosen per block to minimise the encoded size, so a few
+//         large gaps do not widen the whole block.
+enum class postings_codec { raw, varint, pfor };
+
+namespace codec
+{
+	inline void put_varint(std::vector<uint8_t>& out, uint32_t v) {
+		while (v >= 0x80) {
+			out.push_back((uint8_t)(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back((uint8_t)v);
+	}
+
+	inline uint32_t get_varint(const uint8_t*& in) {
+		uint32_t v = 0;
+		int shift = 0;
+		while (*in & 0x80) {
+			v |= (uint32_t)(*in++ & 0x7f) << shift;
+			shift += 7;
+		}
+		v |= (uint32_t)(*in++) << shift;
+		return v;
+	}
+
+	inline size_t varint_size(uint32_t v) {
+		size_t n = 1;
+		while (v >= 0x80) {
+			v >>= 7;
+			++n;
+		}
+		return n;
+	}
+
+	inline void encode_varint(const uint32_t* values, size_t n, std::vector<uint8_t>& out) {
+		for (size_t i = 0; i < n; ++i) put_varint(out, values[i]);
+	}
+
+	inline const uint8_t* decode_varint(const uint8_t* in, size_t n, uint32_t* values) {
+		for (size_t i = 0; i < n; ++i) values[i] = get_varint(in);
+		return in;
+	}
+
+	inline uint32_t bit_width(uint32_t v) {
+		uint32_t b = 0;
+		while (v != 0) {
+			v >>= 1;
+			++b;
+		}
+		return b;
+	}
+
+	inline void encode_pfor(const uint32_t* values, size_t n, std::vector<uint8_t>& out) {
+		// cost of every candidate width: packed payload plus exceptions,
+		// priced from a histogram of the values' own bit widths
+		size_t widths[33] = {};
+		for (size_t i = 0; i < n; ++i) widths[bit_width(values[i])] += 1;
+
+		uint32_t best_bits = 32;
+		size_t best_cost = SIZE_MAX;
+		for (uint32_t b = 0; b <= 32; ++b) {
+			size_t cost = (n * b + 7) / 8;
+			for (uint32_t w = b + 1; w <= 32; ++w) {
+				cost += widths[w] * (1 + (w - b + 6) / 7);
+			}
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_bits = b;
+			}
+		}
+
+		const uint32_t b = best_bits;
+		const uint64_t mask = b == 32 ? 0xffffffffull : ((1ull << b) - 1);
+		std::vector<uint8_t> patches;
+		uint8_t exceptions = 0;
+
+		out.push_back((uint8_t)b);
+		size_t count_at = out.size();
+		out.push_back(0);
+
+		uint64_t acc = 0;
+		uint32_t filled = 0;
+		for (size_t i = 0; i < n; ++i) {
+			acc |= ((uint64_t)values[i] & mask) << filled;
+			filled += b;
+			while (filled >= 8) {
+				out.push_back((uint8_t)acc);
+				acc >>= 8;
+				filled -= 8;
+			}
+			uint32_t high = b == 32 ? 0 : values[i] >> b;
+			if (high != 0) {
+				patches.push_back((uint8_t)i);
+				put_varint(patches, high);
+				++exceptions;
+			}
+		}
+		if (filled > 0) out.push_back((uint8_t)acc);
+
+		out[count_at] = exceptions;
+		out.insert(out.end(), patches.begin(), patches.end());
+	}
+
+	inline const uint8_t* decode_pfor(const uint8_t* in, size_t n, uint32_t* values) {
+		const uint32_t b = *in++;
+		const uint32_t exceptions = *in++;
+		const uint64_t mask = b == 32 ? 0xffffffffull : ((1ull << b) - 1);
+
+		// bytes are pulled into a 64-bit window as the values need them
+		uint64_t acc = 0;
+		uint32_t filled = 0;
+		for (size_t i = 0; i < n; ++i) {
+			while (filled < b) {
+				acc |= (uint64_t)(*in++) << filled;
+				filled += 8;
+			}
+			values[i] = (uint32_t)(acc & mask);
+			acc >>= b;
+			filled -= b;
+		}
+
+		for (uint32_t e = 0; e < exceptions; ++e) {
+			uint32_t pos = *in++;
+			values[pos] |= get_varint(in) << b;
+		}
+		return in;
+	}
+};
@@ -0,0 +1,301 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#define COMPACT_TRIE_NIL 0u
+#define RUN_CLASSES 6
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline uint32_t bit_count(uint32_t x) { return __popcnt(x); }
+static inline uint32_t low_bit_index(uint32_t x) { unsigned long i; _BitScanForward(&i, x); return i; }
+#else
+static inline uint32_t bit_count(uint32_t x) { return __builtin_popcount(x); }
+static inline uint32_t low_bit_index(uint32_t x) { return __builtin_ctz(x); }
+#endif
+
+// Same contract as trie_node, but instead of CH_SIZE slots a node keeps a
+// 26-bit occupancy mask and the offset of a packed run of child indices in
+// the shared links array: the child for letter c sits at
+// links[kids + popcount(mask & ((1 << c) - 1))].
+struct compact_trie_node {
+    uint32_t mask = 0;
+    uint32_t kids = 0;
+    uint32_t count = 0;
+    uint32_t id = 0;
+    uint8_t cap = 0;
+    bool is_term = false;
+
+    bool is_leaf() const { return mask == 0; }
+};
+
+class compact_trie {
+private:
+    std::vector<compact_trie_node> nodes;
+    std::vector<uint32_t> links;
+    std::vector<uint32_t> free_nodes;
+    // released child runs, bucketed by capacity class (1, 2, 4, ... 32)
+    std::vector<uint32_t> free_runs[RUN_CLASSES];
+
+    inline size_t get_index(char sym) const { return (unsigned char)sym - (unsigned char)'a'; }
+
+    static size_t run_class(uint8_t cap) { return low_bit_index(cap); }
+
+    uint32_t _child(const compact_trie_node& node, size_t c) const {
+        uint32_t bit = 1u << c;
+        if ((node.mask & bit) == 0) {
+            return COMPACT_TRIE_NIL;
+        }
+        return links[node.kids + bit_count(node.mask & (bit - 1))];
+    }
+
+    uint32_t _alloc_node() {
+        if (!free_nodes.empty()) {
+            uint32_t idx = free_nodes.back();
+            free_nodes.pop_back();
+            nodes[idx] = compact_trie_node();
+            return idx;
+        }
+
+        nodes.emplace_back();
+        return (uint32_t)(nodes.size() - 1);
+    }
+
+    uint32_t _alloc_run(uint8_t cap) {
+        auto& bucket = free_runs[run_class(cap)];
+        if (!bucket.empty()) {
+            uint32_t off = bucket.back();
+            bucket.pop_back();
+            return off;
+        }
+
+        uint32_t off = (uint32_t)links.size();
+        links.resize(links.size() + cap, COMPACT_TRIE_NIL);
+        return off;
+    }
+
+    void _release_run(uint32_t off, uint8_t cap) {
+        if (cap != 0) {
+            free_runs[run_class(cap)].push_back(off);
+        }
+    }
+
+    void _add_child(uint32_t parent, size_t c, uint32_t child) {
+        uint32_t n = bit_count(nodes[parent].mask);
+        uint32_t bit = 1u << c;
+        uint32_t pos = bit_count(nodes[parent].mask & (bit - 1));
+
+        if (n == nodes[parent].cap) {
+            uint8_t new_cap = nodes[parent].cap == 0 ? 1 : nodes[parent].cap * 2;
+            uint32_t run = _alloc_run(new_cap);
+            uint32_t old = nodes[parent].kids;
+            for (uint32_t i = 0; i < n; i++) {
+                links[run + i] = links[old + i];
+            }
+            _release_run(old, nodes[parent].cap);
+            nodes[parent].kids = run;
+            nodes[parent].cap = new_cap;
+        }
+
+        uint32_t base = nodes[parent].kids;
+        for (uint32_t i = n; i > pos; i--) {
+            links[base + i] = links[base + i - 1];
+        }
+        links[base + pos] = child;
+        nodes[parent].mask |= bit;
+    }
+
+    void _remove_child(uint32_t parent, size_t c) {
+        compact_trie_node& node = nodes[parent];
+        uint32_t n = bit_count(node.mask);
+        uint32_t bit = 1u << c;
+        uint32_t pos = bit_count(node.mask & (bit - 1));
+
+        for (uint32_t i = pos; i + 1 < n; i++) {
+            links[node.kids + i] = links[node.kids + i + 1];
+        }
+        node.mask &= ~bit;
+
+        if (node.mask == 0) {
+            _release_run(node.kids, node.cap);
+            node.kids = 0;
+            node.cap = 0;
+        }
+    }
+
+    void _ensure_root() {
+        if (nodes.empty()) {
+            nodes.emplace_back();
+        }
+    }
+
+    uint32_t _find(const std::string& stem) const {
+        if (nodes.empty()) {
+            return COMPACT_TRIE_NIL;
+        }
+
+        uint32_t cur = 0;
+        for (size_t i = 0; i < stem.size(); i++) {
+            cur = _child(nodes[cur], get_index(stem[i]));
+            if (cur == COMPACT_TRIE_NIL) {
+                return COMPACT_TRIE_NIL;
+            }
+        }
+
+        return cur;
+    }
+
+    uint32_t _insert(const std::string& stem) {
+        _ensure_root();
+
+        uint32_t cur = 0;
+        for (size_t i = 0; i < stem.size(); i++) {
+            size_t c = get_index(stem[i]);
+            uint32_t next = _child(nodes[cur], c);
+            if (next == COMPACT_TRIE_NIL) {
+                next = _alloc_node();
+                _add_child(cur, c, next);
+            }
+            cur = next;
+        }
+
+        nodes[cur].count += 1;
+        nodes[cur].is_term = true;
+        return cur;
+    }
+
+    void _erase(const std::string& stem) {
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> path;
+        path.reserve(stem.size() + 1);
+        path.push_back(0);
+
+        for (size_t i = 0; i < stem.size(); i++) {
+            uint32_t next = _child(nodes[path.back()], get_index(stem[i]));
+            if (next == COMPACT_TRIE_NIL) {
+                return;
+            }
+            path.push_back(next);
+        }
+
+        compact_trie_node& last = nodes[path.back()];
+        if (last.count == 0) {
+            return;
+        }
+        last.count -= 1;
+        if (last.count == 0) {
+            last.is_term = false;
+        }
+
+        for (size_t i = stem.size(); i > 0; i--) {
+            uint32_t idx = path[i];
+            if (nodes[idx].is_term || !nodes[idx].is_leaf()) {
+                break;
+            }
+            _remove_child(path[i - 1], get_index(stem[i - 1]));
+            free_nodes.push_back(idx);
+        }
+    }
+
+    void traverse(std::unordered_map<std::string, int>& tf_map, uint32_t root, std::string& temp) const {
+        uint32_t mask = nodes[root].mask;
+        uint32_t k = nodes[root].kids;
+        while (mask != 0) {
+            uint32_t i = low_bit_index(mask);
+            mask &= mask - 1;
+            uint32_t child = links[k++];
+
+            temp += ('a' + i);
+            traverse(tf_map, child, temp);
+            if (nodes[child].is_term == true) {
+                tf_map.insert(std::make_pair(temp, (int)nodes[child].count));
+            }
+            temp.pop_back();
+        }
+    }
+public:
+    compact_trie() { _ensure_root(); }
+
+    compact_trie(std::vector<std::string>& list) {
+        _ensure_root();
+
+        for (auto& s : list)
+            insert(s);
+    }
+
+    ~compact_trie() { clear(); }
+
+    const compact_trie_node* find(const std::string& stem) const {
+        uint32_t idx = _find(stem);
+        if (idx == COMPACT_TRIE_NIL && (nodes.empty() || !stem.empty())) {
+            return nullptr;
+        }
+        return &nodes[idx];
+    }
+
+    compact_trie_node* insert(const std::string& stem) { return &nodes[_insert(stem)]; }
+
+    void erase(const std::string& stem) { _erase(stem); }
+
+    bool empty() const { return nodes.empty() || nodes[0].is_leaf(); }
+
+    bool contains(const std::string& stem) const {
+        const compact_trie_node* node = find(stem);
+        return node != nullptr && node->count != 0;
+    }
+
+    size_t count(const std::string& stem) const {
+        const compact_trie_node* node = find(stem);
+        return node == nullptr ? 0 : node->count;
+    }
+
+    size_t count(const std::vector<std::string>& stems) const {
+        size_t ans = 0;
+
+        for (size_t i = 0; i < stems.size(); i++) {
+            ans += count(stems[i]);
+        }
+
+        return ans;
+    }
+
+    std::unordered_map<std::string, int> get_tf_map() const {
+        std::unordered_map<std::string, int> tf_map;
+        if (nodes.empty()) {
+            return tf_map;
+        }
+        std::string temp = "";
+        traverse(tf_map, 0, temp);
+        return tf_map;
+    }
+
+    void shrink_to_fit() {
+        nodes.shrink_to_fit();
+        links.shrink_to_fit();
+    }
+
+    void clear() {
+        std::vector<compact_trie_node>().swap(nodes);
+        std::vector<uint32_t>().swap(links);
+        std::vector<uint32_t>().swap(free_nodes);
+        for (auto& bucket : free_runs) {
+            std::vector<uint32_t>().swap(bucket);
+        }
+    }
+
+    size_t get_bytes_count() const {
+        size_t bytes = 0;
+        bytes += nodes.capacity() * sizeof(compact_trie_node);
+        bytes += links.capacity() * sizeof(uint32_t);
+        bytes += free_nodes.capacity() * sizeof(uint32_t);
+        for (auto& bucket : free_runs) {
+            bytes += bucket.capacity() * sizeof(uint32_t);
+        }
+        bytes += sizeof(*this);
+        return bytes;
+    }
+};
@@ -0,0 +1,161 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "index_file.cpp"
+#include "trie.cpp"
+#include "compact_trie.cpp"
+#include "radix_trie.cpp"
+
+// Trie engine behind the term dictionary: trie (26 child slots per node),
+// compact_trie (occupancy bitmap + packed children) or radix_trie
+// (path-compressed)
+#define COMPACT_TERM_TRIE
+#undef  COMPACT_TERM_TRIE
+#define RADIX_TERM_TRIE
+#undef  RADIX_TERM_TRIE
+
+#if defined(COMPACT_TERM_TRIE)
+using term_trie = compact_trie;
+#elif defined(RADIX_TERM_TRIE)
+using term_trie = radix_trie;
+#else
+using term_trie = trie;
+#endif
+
+using term_id = uint32_t;
+using term_count = std::pair<term_id, uint32_t>;
+
+constexpr term_id NO_TERM = UINT32_MAX;
+
+// Corpus-wide stem -> dense id mapping. Every layer past tokenization keys
+// on term_id; the stem strings are only kept here, back to back in text with
+// term t at text[starts[t] .. starts[t + 1]]. The trie count of a term is the
+// number of times it was interned, i.e. its collection frequency.
+//
+// A dictionary loaded from an index file has no trie: lookups binary-search
+// the stored permutation of ids sorted by stem, and the trie is rebuilt the
+// first time a term is interned or released.
+//
+// Releasing the last occurrence of a term erases it from the trie. Its id
+// is never handed out again: the stem stays in text, unknown to find(), and
+// interning it later gives it a new id.
+class term_dictionary {
+private:
+	term_trie index;
+	stored_vector<char> text;
+	stored_vector<uint64_t> starts;
+	// only set while loaded: collection frequencies and ids sorted by stem
+	stored_vector<uint32_t> counts;
+	stored_vector<term_id> sorted;
+
+	bool is_loaded() const { return !sorted.empty(); }
+
+	void rebuild_index() {
+		for (term_id t = 0; t < (term_id)size(); ++t) {
+			if (counts[t] == 0) continue;
+			auto* node = index.insert(std::string(get_term(t)));
+			node->count = counts[t];
+			node->id = t;
+		}
+		counts.clear();
+		sorted.clear();
+	}
+public:
+	term_dictionary() { starts.reset().push_back(0); }
+
+	// adds occurrences to the count of stem and returns its id
+	term_id intern(const std::string& stem, uint32_t occurrences = 1) {
+		if (is_loaded()) rebuild_index();
+		auto* node = index.insert(stem);
+		const bool added = node->count == 1;
+		node->count += occurrences - 1;
+		if (added) {
+			node->id = (term_id)size();
+			auto& t = text.edit();
+			t.insert(t.end(), stem.begin(), stem.end());
+			starts.edit().push_back(t.size());
+		}
+		return node->id;
+	}
+
+	// takes occurrences back from the count of t, e.g. when a document is
+	// removed; the term is erased once nothing is left
+	void release(term_id t, uint32_t occurrences = 1) {
+		if (is_loaded()) rebuild_index();
+		const std::string stem(get_term(t));
+		auto* node = index.insert(stem);
+		// insert() counted one more occurrence, erase() takes it back; a stem
+		// interned again since t was released belongs to another id
+		if (node->id == t) node->count = node->count > occurrences ? node->count - occurrences : 1;
+		index.erase(stem);
+	}
+
+	term_id find(const std::string& stem) const {
+		if (is_loaded()) {
+			auto it = std::lower_bound(sorted.begin(), sorted.end(), stem,
+				[this](term_id t, const std::string& s) { return get_term(t) < s; });
+			return it != sorted.end() && get_term(*it) == stem ? *it : NO_TERM;
+		}
+		auto* node = index.find(stem);
+		if (node == nullptr || node->count == 0) {
+			return NO_TERM;
+		}
+		return node->id;
+	}
+
+	// ids of the known stems, unknown ones are dropped
+	std::vector<term_id> find(const std::vector<std::string>& stems) const {
+		std::vector<term_id> ids;
+		ids.reserve(stems.size());
+		for (const auto& s : stems) {
+			term_id id = find(s);
+			if (id != NO_TERM) ids.push_back(id);
+		}
+		return ids;
+	}
+
+	std::string_view get_term(term_id id) const { return std::string_view(text.data() + starts[id], starts[id + 1] - starts[id]); }
+
+	size_t size() const { return starts.size() - 1; }
+
+	void save(index_file_writer& out) const {
+		std::vector<uint32_t> frequencies(size());
+		std::vector<term_id> by_stem(size());
+		for (term_id t = 0; t < (term_id)size(); ++t) {
+			if (is_loaded()) frequencies[t] = counts[t];
+			else {
+				auto* node = index.find(std::string(get_term(t)));
+				frequencies[t] = node != nullptr && node->id == t ? node->count : 0;
+			}
+			by_stem[t] = t;
+		}
+		// released terms are left out, a stem interned again has one live id
+		by_stem.erase(std::remove_if(by_stem.begin(), by_stem.end(), [&](term_id t) { return frequencies[t] == 0; }), by_stem.end());
+		std::sort(by_stem.begin(), by_stem.end(), [this](term_id a, term_id b) { return get_term(a) < get_term(b); });
+
+		out.add(section_tag("DTXT"), text);
+		out.add(section_tag("DSTA"), starts);
+		out.add_copy(section_tag("DCNT"), frequencies);
+		out.add_copy(section_tag("DSRT"), by_stem);
+	}
+
+	bool load(const mapped_index_file& in) {
+		index.clear();
+		if (!in.view(section_tag("DTXT"), text) || !in.view(section_tag("DSTA"), starts) ||
+			!in.view(section_tag("DCNT"), counts) || !in.view(section_tag("DSRT"), sorted)) return false;
+		if (starts.empty() || starts[0] != 0 || starts[starts.size() - 1] != text.size()) return false;
+		for (size_t t = 0; t < size(); ++t) {
+			if (starts[t] > starts[t + 1]) return false;
+		}
+		return counts.size() == size() && sorted.size() <= size();
+	}
+
+	size_t get_bytes_count() const {
+		size_t bytes = index.get_bytes_count();
+		bytes += text.get_bytes_count() + starts.get_bytes_count();
+		bytes += counts.get_bytes_count() + sorted.get_bytes_count();
+		return bytes;
+	}
+};
@@ -0,0 +1,275 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include "folder_watch.cpp"
+
+namespace fs = std::filesystem;
+
+// Glob match of a whole path: '*' and '?' stay within one path component,
+// '**' spans any number of them (a "**/" prefix also matches nothing) and
+// [abc], [a-z] or [!abc] match one character of a class. ASCII letters
+// match either case, like the extension test this replaces.
+static bool glob_match(std::string_view pattern, std::string_view text) {
+	auto fold = [](char ch) { return (ch >= 'A' && ch <= 'Z') ? (char)(ch - 'A' + 'a') : ch; };
+	// where to resume after the last single '*' and the last '**'
+	size_t p = 0, t = 0;
+	size_t star_p = std::string_view::npos, star_t = 0;
+	size_t globstar_p = std::string_view::npos, globstar_t = 0;
+	while (t < text.size()) {
+		if (p < pattern.size() && pattern[p] == '*') {
+			if (p + 1 < pattern.size() && pattern[p + 1] == '*') {
+				p += 2;
+				if (p < pattern.size() && pattern[p] == '/') ++p;
+				globstar_p = p;
+				globstar_t = t;
+				star_p = std::string_view::npos;
+			}
+			else {
+				star_p = ++p;
+				star_t = t;
+			}
+			continue;
+		}
+		if (p < pattern.size() && pattern[p] == '[') {
+			size_t q = p + 1;
+			const bool negate = q < pattern.size() && pattern[q] == '!';
+			if (negate) ++q;
+			bool matched = false;
+			const size_t first = q;
+			while (q < pattern.size() && (pattern[q] != ']' || q == first)) {
+				if (q + 2 < pattern.size() && pattern[q + 1] == '-' && pattern[q + 2] != ']') {
+					matched = matched || (fold(text[t]) >= fold(pattern[q]) && fold(text[t]) <= fold(pattern[q + 2]));
+					q += 3;
+				}
+				else matched = matched || fold(text[t]) == fold(pattern[q++]);
+			}
+			if (q < pattern.size() && matched != negate && text[t] != '/') {
+				p = q + 1;
+				++t;
+				continue;
+			}
+		}
+		else if (p < pattern.size() && (pattern[p] == '?' ? text[t] != '/' : fold(pattern[p]) == fold(text[t]))) {
+			++p;
+			++t;
+			continue;
+		}
+		// mismatch: let the last '*' take one more character, unless that
+		// would cross a '/', else the last '**'
+		if (star_p != std::string_view::npos && text[star_t] != '/') {
+			p = star_p;
+			t = ++star_t;
+			continue;
+		}
+		if (globstar_p != std::string_view::npos) {
+			p = globstar_p;
+			t = ++globstar_t;
+			star_p = std::string_view::npos;
+			continue;
+		}
+		return false;
+	}
+	while (p < pattern.size() && pattern[p] == '*') ++p;
+	return p == pattern.size();
+}
+
+// Which files discovery takes. Paths are relative to the root, with '/'
+// separators; a pattern without a '/' is matched against the last
+// component only. A file is taken if it matches an include pattern and no
+// exclude pattern; a directory matching an exclude pattern is not entered.
+struct path_filter {
+	std::vector<std::string> include = { "*.txt" };
+	std::vector<std::string> exclude;
+
+	static bool matches_any(const std::vector<std::string>& patterns, const std::string& relative) {
+		const size_t slash = relative.rfind('/');
+		const std::string_view name = slash == std::string::npos ? std::string_view(relative) : std::string_view(relative).substr(slash + 1);
+		for (const auto& pattern : patterns) {
+			if (glob_match(pattern, pattern.find('/') == std::string::npos ? name : std::string_view(relative))) return true;
+		}
+		return false;
+	}
+
+	bool takes_file(const std::string& relative) const { return matches_any(include, relative) && !matches_any(exclude, relative); }
+
+	bool enters_directory(const std::string& relative) const { return !matches_any(exclude, relative); }
+};
+
+// Paths handed from discovery to ingestion as they are found. Readers of
+// path i block until it is there or the feed is closed short of it.
+class path_feed {
+private:
+	std::mutex lock_;
+	std::condition_variable changed_;
+	std::vector<fs::path> paths_;
+	bool closed_ = false;
+public:
+	void push(fs::path path) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			paths_.push_back(std::move(path));
+		}
+		changed_.notify_all();
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			closed_ = true;
+		}
+		changed_.notify_all();
+	}
+
+	// false if the feed closed with no more than i paths
+	bool get(size_t i, fs::path& out) {
+		std::unique_lock<std::mutex> guard(lock_);
+		changed_.wait(guard, [&] { return i < paths_.size() || closed_; });
+		if (i >= paths_.size()) return false;
+		out = paths_[i];
+		return true;
+	}
+
+	// every path, once the feed is closed
+	std::vector<fs::path> all() {
+		std::unique_lock<std::mutex> guard(lock_);
+		changed_.wait(guard, [&] { return closed_; });
+		return paths_;
+	}
+};
+
+// Walks the tree under root on threads workers and pushes every file the
+// filter takes to feed, which is closed at the end. Workers share a stack
+// of directories still to read, each one reading a directory and pushing
+// its subdirectories back. Files go to the feed in a fixed order whatever
+// the timing: a directory's files sorted by name, then its subdirectories
+// in name order, each with its whole subtree. Every directory has a slot
+// holding its listing, and the files are handed out as soon as every slot
+// before them in that order is filled, so ingestion can start on the
+// first directory while the rest of the tree is still being listed.
+// Symbolic links to directories are not followed. directories, unless
+// null, receives every directory entered, root first.
+static void discover_files(const fs::path& root, const path_filter& filter, size_t threads, path_feed& feed,
+	std::vector<fs::path>* directories = nullptr) {
+	struct directory_slot {
+		fs::path path;
+		bool listed = false;
+		std::vector<fs::path> files;
+		// slots of the subdirectories, in name order
+		std::vector<size_t> children;
+	};
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<directory_slot> slots(1);
+	slots[0].path = root;
+	std::vector<size_t> stack(1, 0);
+	// directories on the stack or being read
+	size_t pending = 1;
+	if (directories != nullptr) directories->assign(1, root);
+	// where handing out stopped: (slot, next child) down to the directory
+	// whose listing is awaited
+	std::vector<std::pair<size_t, size_t>> emitted;
+	bool root_emitted = false;
+
+	auto hand_out = [&](size_t slot) {
+		for (auto& f : slots[slot].files) feed.push(std::move(f));
+		std::vector<fs::path>().swap(slots[slot].files);
+	};
+
+	// hands out every file whose turn has come; lock is held
+	auto emit = [&]() {
+		if (!root_emitted) {
+			if (!slots[0].listed) return;
+			hand_out(0);
+			emitted.emplace_back(0, 0);
+			root_emitted = true;
+		}
+		while (!emitted.empty()) {
+			auto& [slot, next] = emitted.back();
+			if (next == slots[slot].children.size()) {
+				emitted.pop_back();
+				continue;
+			}
+			const size_t child = slots[slot].children[next];
+			if (!slots[child].listed) return;
+			++next;
+			hand_out(child);
+			emitted.emplace_back(child, 0);
+		}
+	};
+
+	auto worker = [&]() {
+		std::vector<fs::path> files, subdirectories;
+		while (true) {
+			size_t slot;
+			fs::path directory;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [&] { return !stack.empty() || pending == 0; });
+				if (stack.empty()) return;
+				slot = stack.back();
+				stack.pop_back();
+				directory = slots[slot].path;
+			}
+
+			files.clear();
+			subdirectories.clear();
+			std::error_code error;
+			fs::directory_iterator iterator(directory, error);
+			if (error) std::cerr << "Warning: cannot read directory " << directory.string() << ": " << error.message() << "\n";
+			for (; !error && iterator != fs::directory_iterator(); iterator.increment(error)) {
+				const fs::path p = iterator->path();
+				const std::string relative = p.lexically_relative(root).generic_string();
+				std::error_code status_ec;
+				const fs::file_status link = iterator->symlink_status(status_ec);
+				if (fs::is_directory(link)) {
+					if (filter.enters_directory(relative)) subdirectories.push_back(p);
+				}
+				else if (fs::is_regular_file(p, status_ec) && filter.takes_file(relative)) files.push_back(p);
+			}
+			if (error) std::cerr << "Warning: error while reading " << directory.string() << ": " << error.message() << " -- skipping the rest\n";
+			std::sort(files.begin(), files.end());
+			std::sort(subdirectories.begin(), subdirectories.end());
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (directories != nullptr) directories->insert(directories->end(), subdirectories.begin(), subdirectories.end());
+				for (auto& d : subdirectories) {
+					slots[slot].children.push_back(slots.size());
+					slots.emplace_back();
+					slots.back().path = std::move(d);
+				}
+				// first child on top, so directories tend to be read in the
+				// order they are handed out
+				for (size_t c = slots[slot].children.size(); c-- > 0;) stack.push_back(slots[slot].children[c]);
+				slots[slot].files.swap(files);
+				slots[slot].listed = true;
+				pending += subdirectories.size();
+				pending -= 1;
+				emit();
+			}
+			changed.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t + 1 < std::max<size_t>(1, threads); ++t) workers.emplace_back(worker);
+	worker();
+	for (auto& w : workers) w.join();
+	feed.close();
+}
+
+// discover_files() without the overlap: the whole listing at once
+static std::vector<fs::path> find_files(const fs::path& root, const path_filter& filter, size_t threads,
+	std::vector<fs::path>* directories = nullptr) {
+	path_feed feed;
+	discover_files(root, filter, threads, feed, directories);
+	return feed.all();
+}
@@ -0,0 +1,159 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "benchmarks.cpp"
+
+// Forward store used for snippets and document updates. Keeps every
+// document's text back to back and, per document, its term ids in ascending
+// order with their frequencies and the byte offset of each term's first
+// occurrence, so the place to cut a snippet from is a binary search away
+// and the original file is never opened at query time.
+// Built during ingestion and saved with the index. A loaded store is viewed
+// in place like the rest of the index and never edited: documents added
+// later go to a tail on the heap, and save() writes both as one.
+class document_store {
+private:
+	// documents back to back; the starts have one entry more than there
+	// are documents, into text and into terms, counts and first
+	struct part {
+		stored_vector<char> text;
+		stored_vector<uint64_t> text_starts;
+		stored_vector<uint64_t> term_starts;
+		stored_vector<term_id> terms;
+		stored_vector<uint32_t> counts;
+		stored_vector<uint32_t> first;
+
+		size_t size() const { return text_starts.empty() ? 0 : text_starts.size() - 1; }
+
+		size_t get_bytes_count() const {
+			return text.get_bytes_count() + text_starts.get_bytes_count() + term_starts.get_bytes_count() +
+				terms.get_bytes_count() + counts.get_bytes_count() + first.get_bytes_count();
+		}
+	};
+
+	// documents of the index file
+	part base_;
+	// documents added since
+	part tail_;
+
+	// the part holding document d, d becoming its index there
+	const part& locate(size_t& d) const {
+		if (d < base_.size()) return base_;
+		d -= base_.size();
+		return tail_;
+	}
+
+	// starts of a followed by those of b, shifted past the data of a
+	static std::vector<uint64_t> joined_starts(const stored_vector<uint64_t>& a, const stored_vector<uint64_t>& b) {
+		std::vector<uint64_t> starts(a.begin(), a.end());
+		const uint64_t shift = a[a.size() - 1];
+		for (size_t i = 1; i < b.size(); ++i) starts.push_back(b[i] + shift);
+		return starts;
+	}
+public:
+	document_store() {}
+
+	size_t size() const { return base_.size() + tail_.size(); }
+
+	// appends the next document; terms as in doc_t, first parallel to them
+	void add(const char* text, size_t length, const std::vector<term_count>& terms, const std::vector<uint32_t>& first) {
+		std::vector<char>& all_text = tail_.text.edit();
+		std::vector<uint64_t>& text_starts = tail_.text_starts.edit();
+		std::vector<uint64_t>& term_starts = tail_.term_starts.edit();
+		std::vector<term_id>& all_terms = tail_.terms.edit();
+		std::vector<uint32_t>& all_counts = tail_.counts.edit();
+		std::vector<uint32_t>& all_first = tail_.first.edit();
+		if (text_starts.empty()) text_starts.push_back(0);
+		if (term_starts.empty()) term_starts.push_back(0);
+
+		all_text.insert(all_text.end(), text, text + length);
+		text_starts.push_back(all_text.size());
+		for (const auto& t : terms) {
+			all_terms.push_back(t.first);
+			all_counts.push_back(t.second);
+		}
+		all_first.insert(all_first.end(), first.begin(), first.end());
+		term_starts.push_back(all_terms.size());
+	}
+
+	// store of documents kept[0], kept[1], ... as 0, 1, ...
+	document_store compacted(const std::vector<uint32_t>& kept) const {
+		document_store compacted;
+		for (uint32_t d : kept) {
+			size_t i = d;
+			const part& p = locate(i);
+			const std::string_view t = text(d);
+			compacted.add(t.data(), t.size(), terms(d),
+				std::vector<uint32_t>(p.first.data() + p.term_starts[i], p.first.data() + p.term_starts[i + 1]));
+		}
+		return compacted;
+	}
+
+	std::string_view text(size_t d) const {
+		const part& p = locate(d);
+		return std::string_view(p.text.data() + p.text_starts[d], p.text_starts[d + 1] - p.text_starts[d]);
+	}
+
+	// (term id, frequency) of document d, sorted by term id
+	std::vector<term_count> terms(size_t d) const {
+		const part& p = locate(d);
+		std::vector<term_count> out;
+		out.reserve(p.term_starts[d + 1] - p.term_starts[d]);
+		for (size_t i = p.term_starts[d]; i < p.term_starts[d + 1]; ++i) out.emplace_back(p.terms[i], p.counts[i]);
+		return out;
+	}
+
+	// byte offset of the earliest occurrence of any of the query terms in
+	// document d, std::string::npos if it has none of them
+	size_t first_occurrence(size_t d, const std::vector<term_id>& query) const {
+		const part& p = locate(d);
+		const term_id* begin = p.terms.data() + p.term_starts[d];
+		const term_id* end = p.terms.data() + p.term_starts[d + 1];
+		size_t best = std::string::npos;
+		for (term_id t : query) {
+			if (t == NO_TERM) continue;
+			const term_id* it = std::lower_bound(begin, end, t);
+			if (it != end && *it == t) best = std::min<size_t>(best, p.first[it - p.terms.data()]);
+		}
+		return best;
+	}
+
+	void save(index_file_writer& out) const {
+		if (base_.size() == 0 || tail_.size() == 0) {
+			const part& p = tail_.size() == 0 ? base_ : tail_;
+			out.add(section_tag("STXT"), p.text);
+			out.add(section_tag("STST"), p.text_starts);
+			out.add(section_tag("STRS"), p.term_starts);
+			out.add(section_tag("STRM"), p.terms);
+			out.add(section_tag("STCN"), p.counts);
+			out.add(section_tag("SFST"), p.first);
+			return;
+		}
+		out.add_joined(section_tag("STXT"), base_.text, tail_.text);
+		out.add_copy(section_tag("STST"), joined_starts(base_.text_starts, tail_.text_starts));
+		out.add_copy(section_tag("STRS"), joined_starts(base_.term_starts, tail_.term_starts));
+		out.add_joined(section_tag("STRM"), base_.terms, tail_.terms);
+		out.add_joined(section_tag("STCN"), base_.counts, tail_.counts);
+		out.add_joined(section_tag("SFST"), base_.first, tail_.first);
+	}
+
+	// false if a section is missing or the offsets do not fit the data
+	bool load(const mapped_index_file& in) {
+		*this = document_store();
+		part& p = base_;
+		if (!in.view(section_tag("STXT"), p.text) || !in.view(section_tag("STST"), p.text_starts) ||
+			!in.view(section_tag("STRS"), p.term_starts) || !in.view(section_tag("STRM"), p.terms) ||
+			!in.view(section_tag("STCN"), p.counts) || !in.view(section_tag("SFST"), p.first)) return false;
+		if (p.text_starts.empty() || p.term_starts.size() != p.text_starts.size() ||
+			p.terms.size() != p.first.size() || p.terms.size() != p.counts.size() || p.text_starts[0] != 0 || p.term_starts[0] != 0 ||
+			p.text_starts[p.size()] != p.text.size() || p.term_starts[p.size()] != p.terms.size()) return false;
+		for (size_t d = 0; d < p.size(); ++d) {
+			if (p.text_starts[d] > p.text_starts[d + 1] || p.term_starts[d] > p.term_starts[d + 1]) return false;
+		}
+		return true;
+	}
+
+	size_t get_bytes_count() const { return base_.get_bytes_count() + tail_.get_bytes_count(); }
+};
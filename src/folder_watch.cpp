@@ -0,0 +1,140 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "segments.cpp"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#define FOLDER_WATCH_SUPPORTED
+#endif
+
+// a batch of changes is handed out once the folder has been quiet this long
+#define WATCH_SETTLE_MS 250
+
+// Reports changes to the files of a folder tree, through inotify: one
+// watch per directory, added by the caller for every directory it indexes.
+// Events are collected until the tree has been quiet for WATCH_SETTLE_MS,
+// so that a burst of writes, or an editor saving through a temporary file
+// and a rename, comes out as one batch. Without inotify open() always
+// fails.
+class folder_watch {
+private:
+	int fd_ = -1;
+	int root_watch_ = -1;
+	std::string root_;
+	// watch descriptor -> path of the directory relative to the root, with
+	// a trailing '/' unless it is the root
+	std::unordered_map<int, std::string> directories_;
+
+#ifdef FOLDER_WATCH_SUPPORTED
+	// reads the pending events; false once the root itself is gone
+	bool read_events(std::vector<std::string>& names, bool& rescan) {
+		alignas(inotify_event) char buffer[16 * 1024];
+		while (true) {
+			const ssize_t got = ::read(fd_, buffer, sizeof(buffer));
+			if (got <= 0) return true;
+			for (ssize_t at = 0; at < got;) {
+				const inotify_event* e = reinterpret_cast<const inotify_event*>(buffer + at);
+				at += sizeof(inotify_event) + e->len;
+				if (e->mask & IN_Q_OVERFLOW) rescan = true;
+				if (e->wd == root_watch_ && (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) return false;
+				if (e->mask & IN_IGNORED) directories_.erase(e->wd);
+				// a directory that appears or leaves may hold any number of files
+				if ((e->mask & IN_ISDIR) && (e->mask & (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM))) rescan = true;
+				auto it = directories_.find(e->wd);
+				if (e->len != 0 && !(e->mask & IN_ISDIR) && it != directories_.end()) names.push_back(it->second + e->name);
+			}
+		}
+	}
+
+	// the watch descriptor, -1 on failure
+	int add_watch(const std::string& relative) {
+		const std::string path = relative.empty() ? root_ : root_ + "/" + relative;
+		const int watch = inotify_add_watch(fd_, path.c_str(),
+			IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (watch >= 0) directories_[watch] = relative.empty() ? relative : relative + "/";
+		return watch;
+	}
+#endif
+public:
+	folder_watch() {}
+
+	folder_watch(const folder_watch&) = delete;
+
+	folder_watch& operator=(const folder_watch&) = delete;
+
+	~folder_watch() { close(); }
+
+	// starts watching the root directory itself
+	bool open(const std::string& root) {
+		close();
+#ifdef FOLDER_WATCH_SUPPORTED
+		fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd_ < 0) return false;
+		root_ = root;
+		root_watch_ = add_watch("");
+		if (root_watch_ < 0) {
+			close();
+			return false;
+		}
+		return true;
+#else
+		(void)root;
+		return false;
+#endif
+	}
+
+	// adds the directory at relative, a path below the root with '/'
+	// separators; watching a directory twice is harmless
+	bool watch_directory(const std::string& relative) {
+#ifdef FOLDER_WATCH_SUPPORTED
+		return fd_ >= 0 && add_watch(relative) >= 0;
+#else
+		(void)relative;
+		return false;
+#endif
+	}
+
+	void close() {
+#ifdef FOLDER_WATCH_SUPPORTED
+		if (fd_ >= 0) ::close(fd_);
+#endif
+		fd_ = -1;
+		root_watch_ = -1;
+		directories_.clear();
+	}
+
+	bool is_open() const { return fd_ >= 0; }
+
+	// Waits up to timeout_ms for something to change, then for the tree to
+	// settle. names gets the files that changed, relative to the root and
+	// once each; rescan is set when events were lost or a directory came
+	// or went, and the whole tree has to be looked at again. False if
+	// nothing changed; once the root itself is deleted or moved the watch
+	// closes and wait() keeps returning false.
+	bool wait(int timeout_ms, std::vector<std::string>& names, bool& rescan) {
+		names.clear();
+		rescan = false;
+#ifdef FOLDER_WATCH_SUPPORTED
+		if (fd_ < 0) return false;
+		pollfd p = { fd_, POLLIN, 0 };
+		int timeout = timeout_ms;
+		while (::poll(&p, 1, timeout) > 0) {
+			if (!read_events(names, rescan)) {
+				close();
+				break;
+			}
+			timeout = WATCH_SETTLE_MS;
+		}
+		std::sort(names.begin(), names.end());
+		names.erase(std::unique(names.begin(), names.end()), names.end());
+		return !names.empty() || rescan;
+#else
+		(void)timeout_ms;
+		return false;
+#endif
+	}
+};
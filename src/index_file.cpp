@@ -0,0 +1,334 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "mapped_file.cpp"
+
+// Persistent index file. Layout, every part aligned to 8 bytes:
+//
+//   index_file_header
+//   index_section[section_count]      tag, byte offset and length of each section
+//   section payloads                  plain arrays, exactly as they sit in memory
+//
+// The checksum covers everything after the header. A loaded file is mapped
+// read-only and its sections are used in place, nothing is parsed or copied.
+#define INDEX_FILE_VERSION 3
+#define INDEX_FILE_BYTE_ORDER 0x01020304u
+
+struct index_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	// fingerprint of the settings the index was built with, see main()
+	uint64_t fingerprint;
+	uint64_t checksum;
+	uint64_t file_bytes;
+	uint32_t section_count;
+	uint32_t reserved;
+};
+
+struct index_section {
+	uint32_t tag;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+static const char INDEX_FILE_MAGIC[8] = { 'S', 'E', 'I', 'D', 'X', 0, 0, 0 };
+
+// four-character section tag
+constexpr uint32_t section_tag(const char (&s)[5]) {
+	return (uint32_t)(uint8_t)s[0] | (uint32_t)(uint8_t)s[1] << 8 | (uint32_t)(uint8_t)s[2] << 16 | (uint32_t)(uint8_t)s[3] << 24;
+}
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+// Word-at-a-time FNV-style hash; bytes must be a multiple of 8.
+static uint64_t index_checksum(uint64_t h, const void* data, size_t bytes) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < bytes; i += 8) {
+		uint64_t w;
+		std::memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+#define INDEX_CHECKSUM_SEED 0xcbf29ce484222325ull
+
+// Read-only array that either owns its elements or views them inside a
+// mapped index file. Writing goes through reset() (start over) or edit()
+// (keep the contents), both leave the array owning its elements.
+template <class T>
+class stored_vector {
+private:
+	std::vector<T> owned_;
+	const T* view_ = nullptr;
+	size_t view_size_ = 0;
+public:
+	bool is_mapped() const { return view_ != nullptr; }
+
+	const T* data() const { return view_ != nullptr ? view_ : owned_.data(); }
+
+	size_t size() const { return view_ != nullptr ? view_size_ : owned_.size(); }
+
+	bool empty() const { return size() == 0; }
+
+	const T& operator[](size_t i) const { return data()[i]; }
+
+	const T* begin() const { return data(); }
+
+	const T* end() const { return data() + size(); }
+
+	void view(const T* data, size_t n) {
+		std::vector<T>().swap(owned_);
+		view_ = data;
+		view_size_ = n;
+	}
+
+	std::vector<T>& reset() {
+		view_ = nullptr;
+		view_size_ = 0;
+		owned_.clear();
+		return owned_;
+	}
+
+	std::vector<T>& edit() {
+		if (view_ != nullptr) {
+			owned_.assign(view_, view_ + view_size_);
+			view_ = nullptr;
+			view_size_ = 0;
+		}
+		return owned_;
+	}
+
+	void clear() {
+		reset();
+		owned_.shrink_to_fit();
+	}
+
+	// heap memory only, mapped pages belong to the file
+	size_t get_bytes_count() const { return owned_.capacity() * sizeof(T); }
+};
+
+// Collects sections and writes them in one go. Sections are referenced, not
+// copied, so the data must stay alive until write().
+class index_file_writer {
+private:
+	struct pending {
+		uint32_t tag;
+		const void* data;
+		size_t bytes;
+	};
+	std::vector<pending> sections_;
+	std::vector<std::vector<char>> owned_;
+public:
+	template <class T>
+	void add(uint32_t tag, const T* data, size_t n) {
+		sections_.push_back({ tag, data, n * sizeof(T) });
+	}
+
+	template <class T>
+	void add(uint32_t tag, const stored_vector<T>& v) { add(tag, v.data(), v.size()); }
+
+	template <class T>
+	void add(uint32_t tag, const std::vector<T>& v) { add(tag, v.data(), v.size()); }
+
+	// copies v into the writer, for data produced only to be saved
+	template <class T>
+	void add_copy(uint32_t tag, const std::vector<T>& v) {
+		const char* p = reinterpret_cast<const char*>(v.data());
+		owned_.emplace_back(p, p + v.size() * sizeof(T));
+		add(tag, owned_.back().data(), owned_.back().size());
+	}
+
+	// one section holding a followed by b, copied
+	template <class T>
+	void add_joined(uint32_t tag, const stored_vector<T>& a, const stored_vector<T>& b) {
+		owned_.emplace_back((a.size() + b.size()) * sizeof(T));
+		char* p = owned_.back().data();
+		if (!a.empty()) std::memcpy(p, a.data(), a.size() * sizeof(T));
+		if (!b.empty()) std::memcpy(p + a.size() * sizeof(T), b.data(), b.size() * sizeof(T));
+		add(tag, owned_.back().data(), owned_.back().size());
+	}
+
+	// strings as one character blob plus n + 1 start offsets
+	void add_strings(uint32_t starts_tag, uint32_t text_tag, const std::vector<std::string>& strings) {
+		std::vector<uint64_t> starts(1, 0);
+		std::vector<char> text;
+		for (const auto& s : strings) {
+			text.insert(text.end(), s.begin(), s.end());
+			starts.push_back(text.size());
+		}
+		add_copy(starts_tag, starts);
+		add_copy(text_tag, text);
+	}
+
+	// writes to a temporary file first and renames it over path, so a
+	// crash never leaves a half-written index behind
+	bool write(const std::string& path, uint64_t fingerprint) const {
+		std::vector<index_section> table(sections_.size());
+		size_t offset = align8(sizeof(index_file_header) + table.size() * sizeof(index_section));
+		for (size_t i = 0; i < sections_.size(); ++i) {
+			table[i] = { sections_[i].tag, 0, offset, sections_[i].bytes };
+			offset += align8(sections_[i].bytes);
+		}
+
+		static const uint8_t zeros[8] = {};
+		uint64_t checksum = index_checksum(INDEX_CHECKSUM_SEED, table.data(), table.size() * sizeof(index_section));
+		for (const auto& s : sections_) {
+			const size_t whole = s.bytes & ~(size_t)7;
+			checksum = index_checksum(checksum, s.data, whole);
+			if (whole != s.bytes) {
+				uint8_t tail[8] = {};
+				std::memcpy(tail, static_cast<const uint8_t*>(s.data) + whole, s.bytes - whole);
+				checksum = index_checksum(checksum, tail, 8);
+			}
+		}
+
+		index_file_header header;
+		std::memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+		header.version = INDEX_FILE_VERSION;
+		header.byte_order = INDEX_FILE_BYTE_ORDER;
+		header.fingerprint = fingerprint;
+		header.checksum = checksum;
+		header.file_bytes = offset;
+		header.section_count = (uint32_t)table.size();
+		header.reserved = 0;
+
+		const std::string temp = path + ".tmp";
+		FILE* f = std::fopen(temp.c_str(), "wb");
+		if (f == nullptr) return false;
+		bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+		ok = ok && (table.empty() || std::fwrite(table.data(), sizeof(index_section), table.size(), f) == table.size());
+		for (const auto& s : sections_) {
+			if (!ok) break;
+			ok = s.bytes == 0 || std::fwrite(s.data, 1, s.bytes, f) == s.bytes;
+			ok = ok && std::fwrite(zeros, 1, align8(s.bytes) - s.bytes, f) == align8(s.bytes) - s.bytes;
+		}
+		ok = std::fclose(f) == 0 && ok;
+		if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+			std::remove(temp.c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+// Strings stored by add_strings(), viewed in place.
+class string_table {
+private:
+	const uint64_t* starts_ = nullptr;
+	const char* text_ = nullptr;
+	size_t size_ = 0;
+public:
+	string_table() {}
+
+	string_table(const uint64_t* starts, const char* text, size_t size) : starts_(starts), text_(text), size_(size) {}
+
+	size_t size() const { return size_; }
+
+	std::string_view operator[](size_t i) const { return std::string_view(text_ + starts_[i], starts_[i + 1] - starts_[i]); }
+};
+
+// A validated, read-only mapping of an index file. Everything viewed through
+// it is valid for as long as the object lives.
+class mapped_index_file {
+private:
+	mapped_file file_;
+	const uint8_t* base_ = nullptr;
+	size_t bytes_ = 0;
+	const index_file_header* header_ = nullptr;
+	const index_section* sections_ = nullptr;
+
+	bool validate(uint64_t fingerprint) {
+		if (bytes_ < sizeof(index_file_header)) return false;
+		header_ = reinterpret_cast<const index_file_header*>(base_);
+		if (std::memcmp(header_->magic, INDEX_FILE_MAGIC, sizeof(header_->magic)) != 0) return false;
+		if (header_->version != INDEX_FILE_VERSION || header_->byte_order != INDEX_FILE_BYTE_ORDER) return false;
+		if (header_->file_bytes != bytes_ || header_->fingerprint != fingerprint) return false;
+
+		const size_t table_end = sizeof(index_file_header) + (size_t)header_->section_count * sizeof(index_section);
+		if (table_end > bytes_) return false;
+		sections_ = reinterpret_cast<const index_section*>(base_ + sizeof(index_file_header));
+		for (uint32_t i = 0; i < header_->section_count; ++i) {
+			const index_section& s = sections_[i];
+			if (s.offset % 8 != 0 || s.offset < table_end || s.offset > bytes_ || s.bytes > bytes_ - s.offset) return false;
+		}
+
+		const size_t body = bytes_ - sizeof(index_file_header);
+		return body % 8 == 0 && index_checksum(INDEX_CHECKSUM_SEED, base_ + sizeof(index_file_header), body) == header_->checksum;
+	}
+public:
+	mapped_index_file() {}
+
+	mapped_index_file(const mapped_index_file&) = delete;
+
+	mapped_index_file& operator=(const mapped_index_file&) = delete;
+
+	// maps path and checks header, bounds and checksum; false if the file is
+	// missing, damaged, of another version or built with other settings
+	bool open(const std::string& path, uint64_t fingerprint) {
+		close();
+		// always mapped, queries touch the postings in no particular order
+		if (!file_.open(path, false, 0)) return false;
+		base_ = reinterpret_cast<const uint8_t*>(file_.data());
+		bytes_ = file_.size();
+		if (!validate(fingerprint)) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+		file_.close();
+		base_ = nullptr;
+		bytes_ = 0;
+		header_ = nullptr;
+		sections_ = nullptr;
+	}
+
+	bool is_open() const { return base_ != nullptr; }
+
+	size_t size() const { return bytes_; }
+
+	// the section's elements, false if it is missing or not a whole number of T
+	template <class T>
+	bool find(uint32_t tag, const T*& data, size_t& n) const {
+		if (header_ == nullptr) return false;
+		for (uint32_t i = 0; i < header_->section_count; ++i) {
+			if (sections_[i].tag != tag) continue;
+			if (sections_[i].bytes % sizeof(T) != 0) return false;
+			data = reinterpret_cast<const T*>(base_ + sections_[i].offset);
+			n = sections_[i].bytes / sizeof(T);
+			return true;
+		}
+		return false;
+	}
+
+	template <class T>
+	bool view(uint32_t tag, stored_vector<T>& out) const {
+		const T* data = nullptr;
+		size_t n = 0;
+		if (!find(tag, data, n)) return false;
+		out.view(data, n);
+		return true;
+	}
+
+	bool strings(uint32_t starts_tag, uint32_t text_tag, string_table& out) const {
+		const uint64_t* starts = nullptr;
+		const char* text = nullptr;
+		size_t n_starts = 0, n_text = 0;
+		if (!find(starts_tag, starts, n_starts) || !find(text_tag, text, n_text) || n_starts == 0 || starts[0] != 0) return false;
+		for (size_t i = 0; i + 1 < n_starts; ++i) {
+			if (starts[i] > starts[i + 1]) return false;
+		}
+		if (starts[n_starts - 1] != n_text) return false;
+		out = string_table(starts, text, n_starts - 1);
+		return true;
+	}
+};
@@ -1,46 +1,142 @@
 #include <unordered_map>
+#include <algorithm>
 #include "tokenizer.cpp"
+#include "dictionary.cpp"
+
+struct stem_count {
+    std::string stem;
+    uint32_t count;
+    // byte offset of the first token with this stem
+    uint32_t first;
+};
+
+// Distinct stems of a text in order of first occurrence, with their
+// frequencies. Needs no dictionary, so it can run on any thread. With
+// sequence, also records the stem index of every term in text order, from
+// which doc_t derives term positions.
+static std::vector<stem_count> count_stems(const char* text, size_t length, std::vector<uint32_t>* sequence = nullptr) {
+    std::unordered_map<std::string, uint32_t> position;
+    std::vector<stem_count> stems;
+    // reused lookup key, only stems seen for the first time are copied
+    std::string key;
+    for_each_term(text, length, [&](std::string_view term, size_t offset) {
+        key.assign(term.data(), term.size());
+        auto it = position.find(key);
+        if (it == position.end()) {
+            it = position.emplace(key, (uint32_t)stems.size()).first;
+            stems.push_back({ key, 0, (uint32_t)offset });
+        }
+        stems[it->second].count += 1;
+        if (sequence != nullptr) sequence->push_back(it->second);
+    });
+    return stems;
+}
+
+static std::vector<stem_count> count_stems(const std::string& text) { return count_stems(text.data(), text.size()); }
 
 class doc_t {
 private:
     std::string path;
-    trie* content = nullptr;
+    // (term id, term frequency), sorted by term id
+    std::vector<term_count> terms;
+    // byte offset of each term's first occurrence, parallel to terms;
+    // empty for loaded documents
+    std::vector<uint32_t> first_offsets;
+    // token positions (term ordinals in the text) of terms[i] are
+    // positions[position_starts[i] .. position_starts[i + 1]], ascending;
+    // both empty unless positions were asked for
+    std::vector<uint32_t> position_starts;
+    std::vector<uint32_t> positions;
+
+    // buckets the term ordinals of sequence by term; order[k] is the stem
+    // behind terms[k]
+    void set_positions(const std::vector<stem_count>& stems, const std::vector<uint32_t>& order, const std::vector<uint32_t>& sequence) {
+        std::vector<uint32_t> slot(stems.size());
+        position_starts.assign(order.size() + 1, 0);
+        for (size_t k = 0; k < order.size(); ++k) {
+            slot[order[k]] = position_starts[k];
+            position_starts[k + 1] = position_starts[k] + stems[order[k]].count;
+        }
+        positions.resize(sequence.size());
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            positions[slot[sequence[i]]++] = (uint32_t)i;
+        }
+    }
 public:
     doc_t() = delete;
 
-    doc_t(std::string path, std::string& text) {
-        content = new trie;
-        this->path = path;
-        std::vector<std::string> tokens = get_tokens(text);
-        for (auto& t : tokens) {
-            content->insert(t);
+    doc_t(std::string path, std::string& text, term_dictionary& dictionary)
+        : doc_t(std::move(path), count_stems(text), dictionary) {}
+
+    // Interning in first-occurrence order hands out the same term ids as
+    // interning token by token. sequence, when given, is the one filled by
+    // count_stems() and makes the document keep its term positions.
+    doc_t(std::string path, const std::vector<stem_count>& stems, term_dictionary& dictionary,
+        const std::vector<uint32_t>* sequence = nullptr) {
+        this->path = std::move(path);
+        std::vector<term_id> ids(stems.size());
+        std::vector<uint32_t> order(stems.size());
+        for (size_t s = 0; s < stems.size(); ++s) {
+            ids[s] = dictionary.intern(stems[s].stem, stems[s].count);
+            order[s] = (uint32_t)s;
+        }
+        std::sort(order.begin(), order.end(), [&ids](uint32_t a, uint32_t b) { return ids[a] < ids[b]; });
+        terms.reserve(order.size());
+        first_offsets.reserve(order.size());
+        for (uint32_t s : order) {
+            terms.emplace_back(ids[s], stems[s].count);
+            first_offsets.push_back(stems[s].first);
         }
+        if (sequence != nullptr) set_positions(stems, order, *sequence);
     }
 
+    // document restored from an index file, its terms live only in the postings
+    explicit doc_t(std::string path) : path(std::move(path)) {}
+
     doc_t(const doc_t& other) {
         this->path = other.path;
-        this->content = other.content;
+        this->terms = other.terms;
+        this->first_offsets = other.first_offsets;
+        this->position_starts = other.position_starts;
+        this->positions = other.positions;
     }
 
     doc_t(doc_t&& other) noexcept {
-        this->path = other.path;
-        this->content = other.content;
+        this->path = std::move(other.path);
+        this->terms = std::move(other.terms);
+        this->first_offsets = std::move(other.first_offsets);
+        this->position_starts = std::move(other.position_starts);
+        this->positions = std::move(other.positions);
     }
 
-    ~doc_t() {
-        delete content;
-        content = nullptr;
+    const std::vector<term_count>& get_terms() const { return terms; }
+
+    const std::vector<uint32_t>& get_first_offsets() const { return first_offsets; }
+
+    bool has_positions() const { return !position_starts.empty(); }
+
+    // ascending token positions of terms[i] as (pointer, count), none if
+    // the document was made without positions
+    std::pair<const uint32_t*, size_t> get_positions(size_t i) const {
+        if (!has_positions()) return { nullptr, 0 };
+        return { positions.data() + position_starts[i], position_starts[i + 1] - position_starts[i] };
     }
 
-    const trie* get_content() { return content; }
+    // drops the positions once the index holds them in its postings
+    void release_positions() {
+        std::vector<uint32_t>().swap(position_starts);
+        std::vector<uint32_t>().swap(positions);
+    }
 
     std::string get_path() const { return path; }
 
     size_t get_bytes_count() {
         size_t bytes = 0;
         bytes += sizeof(path) + path.capacity();
-        //bytes += ... (trie)
-        bytes += content->get_bytes_count();
+        bytes += sizeof(terms) + terms.capacity() * sizeof(term_count);
+        bytes += sizeof(first_offsets) + first_offsets.capacity() * sizeof(uint32_t);
+        bytes += sizeof(position_starts) + position_starts.capacity() * sizeof(uint32_t);
+        bytes += sizeof(positions) + positions.capacity() * sizeof(uint32_t);
         return bytes;
     }
 };
@@ -68,4 +164,20 @@ public:
 	size_t capacity() { return list.capacity(); }
 
     doc_t* back() { return list.back(); }
+
+	// keeps the documents at the ascending positions given, renumbered in
+	// that order, and deletes the others
+	void keep(const std::vector<uint32_t>& positions) {
+		std::vector<doc_t*> kept;
+		kept.reserve(positions.size());
+		size_t next = 0;
+		for (size_t d = 0; d < list.size(); ++d) {
+			if (next < positions.size() && positions[next] == d) {
+				kept.push_back(list[d]);
+				++next;
+			}
+			else delete list[d];
+		}
+		list.swap(kept);
+	}
 };
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// files below this size are read rather than mapped, a read() into a warm
+// buffer is cheaper than setting up and tearing down a mapping
+#define MAPPED_FILE_MIN_MAP (64 * 1024)
+// min_map that reads every file: a mapping faults with SIGBUS once the file
+// is cut short under it, so files that may change while open are read
+#define MAPPED_FILE_NEVER_MAP SIZE_MAX
+
+// Read-only view of a whole file. Files of at least min_map bytes are mapped
+// with mmap; smaller ones, and any mmap refuses, are read with one sized
+// read() into a buffer that is kept across open() calls, so a mapped_file
+// reused for many files stops allocating once the buffer has grown; with
+// MAPPED_FILE_NEVER_MAP every file is read. A file cut short while being
+// read fails to open. The data is 8-byte aligned either way.
+class mapped_file {
+private:
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+	bool mapped_ = false;
+	std::vector<uint64_t> buffer_;
+public:
+	mapped_file() {}
+
+	mapped_file(const mapped_file&) = delete;
+
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	~mapped_file() { close(); }
+
+	// sequential: the caller reads the file front to back once, the kernel
+	// is told to read ahead aggressively and drop pages behind
+	bool open(const std::string& path, bool sequential = true, size_t min_map = MAPPED_FILE_MIN_MAP) {
+		close();
+#if defined(_WIN32)
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		if (!in) return false;
+		const size_t size = (size_t)in.tellg();
+		buffer_.resize(std::max<size_t>(1, (size + 7) / 8));
+		in.seekg(0);
+		if (size != 0 && !in.read(reinterpret_cast<char*>(buffer_.data()), size)) return false;
+		data_ = reinterpret_cast<const char*>(buffer_.data());
+		size_ = size;
+		return true;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		const size_t size = (size_t)st.st_size;
+
+		if (size != 0 && size >= min_map) {
+			void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				if (sequential) madvise(p, size, MADV_SEQUENTIAL);
+				::close(fd);
+				data_ = static_cast<const char*>(p);
+				size_ = size;
+				mapped_ = true;
+				return true;
+			}
+		}
+
+		buffer_.resize(std::max<size_t>(1, (size + 7) / 8));
+		char* out = reinterpret_cast<char*>(buffer_.data());
+		size_t done = 0;
+		while (done < size) {
+			ssize_t got = ::read(fd, out + done, size - done);
+			if (got < 0 && errno == EINTR) continue;
+			if (got <= 0) break;
+			done += (size_t)got;
+		}
+		::close(fd);
+		if (done != size) return false;
+		data_ = out;
+		size_ = size;
+		return true;
+#endif
+	}
+
+	void close() {
+#if !defined(_WIN32)
+		if (mapped_) munmap(const_cast<char*>(data_), size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+		mapped_ = false;
+	}
+
+	bool is_open() const { return data_ != nullptr; }
+
+	bool is_mapped() const { return mapped_; }
+
+	const char* data() const { return data_; }
+
+	size_t size() const { return size_; }
+};
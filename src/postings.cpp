@@ -0,0 +1,755 @@
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include "codecs.cpp"
+#include "indexation.cpp"
+
+using doc_id = uint32_t;
+
+#define POSTINGS_BLOCK 64
+
+// Runs work(0) .. work(workers - 1) on their own threads, or directly on
+// the calling thread when there is only one.
+template <class work_fn>
+static void run_workers(size_t workers, work_fn work) {
+	if (workers <= 1) {
+		work(0);
+		return;
+	}
+	std::vector<std::thread> pool;
+	for (size_t w = 0; w < workers; ++w) pool.emplace_back(work, w);
+	for (auto& t : pool) t.join();
+}
+
+// Where the document ids of one term live: either a plain array (raw codec)
+// or a sequence of encoded blocks of gaps. A block's gaps are taken from the
+// last document of the previous block, the first block's from 0.
+struct postings_source {
+	postings_codec codec = postings_codec::raw;
+	const doc_id* ids = nullptr;
+	const uint8_t* encoded = nullptr;
+	const uint32_t* block_data = nullptr;
+	const doc_id* block_last = nullptr;
+	size_t n = 0;
+
+	size_t block_size(size_t b) const { return std::min(n, (b + 1) * POSTINGS_BLOCK) - b * POSTINGS_BLOCK; }
+
+	// writes the documents of block b to out
+	void decode_block(size_t b, doc_id* out) const {
+		const size_t count = block_size(b);
+		if (codec == postings_codec::raw) {
+			std::copy(ids + b * POSTINGS_BLOCK, ids + b * POSTINGS_BLOCK + count, out);
+			return;
+		}
+
+		const uint8_t* in = encoded + block_data[b];
+		if (codec == postings_codec::varint) codec::decode_varint(in, count, out);
+		else codec::decode_pfor(in, count, out);
+
+		doc_id prev = b == 0 ? 0 : block_last[b - 1];
+		for (size_t i = 0; i < count; ++i) {
+			prev += out[i];
+			out[i] = prev;
+		}
+	}
+};
+
+// Forward-only iterator over the postings of one term. Besides walking
+// posting by posting it exposes the block-max metadata: postings are cut
+// into runs of POSTINGS_BLOCK, and for every run the index keeps its last
+// document and an upper bound of the impacts inside it. Compressed blocks
+// are decoded one at a time into the cursor's buffer.
+class postings_cursor {
+private:
+	postings_source source_;
+	const float* weights_ = nullptr;
+	const uint16_t* impacts_ = nullptr;
+	const float* block_max_ = nullptr;
+	size_t pos_ = 0;
+	size_t block_ = 0;
+	size_t loaded_ = SIZE_MAX;
+	doc_id buffer_[POSTINGS_BLOCK];
+
+	void load(size_t b) {
+		if (b == loaded_) return;
+		if (source_.codec != postings_codec::raw) source_.decode_block(b, buffer_);
+		loaded_ = b;
+	}
+
+	doc_id doc_at(size_t i) const {
+		return source_.codec == postings_codec::raw ? source_.ids[i] : buffer_[i % POSTINGS_BLOCK];
+	}
+public:
+	static constexpr doc_id END = UINT32_MAX;
+
+	postings_cursor() {}
+
+	postings_cursor(const postings_source& source, const float* weights, const uint16_t* impacts, const float* block_max)
+		: source_(source), weights_(weights), impacts_(impacts), block_max_(block_max) {
+		if (source_.n != 0) load(0);
+	}
+
+	size_t size() const { return source_.n; }
+
+	doc_id doc() const { return pos_ < source_.n ? doc_at(pos_) : END; }
+
+	float weight() const { return weights_[pos_]; }
+
+	// only if the index has impacts, see postings_index::build_impacts()
+	uint16_t impact() const { return impacts_[pos_]; }
+
+	void next() {
+		++pos_;
+		if (pos_ % POSTINGS_BLOCK == 0 && pos_ < source_.n) load(pos_ / POSTINGS_BLOCK);
+	}
+
+	// moves to the first posting whose document is >= target
+	void advance(doc_id target) {
+		if (pos_ >= source_.n || doc_at(pos_) >= target) return;
+		shallow_advance(target);
+		if (block_exhausted()) {
+			pos_ = source_.n;
+			return;
+		}
+		load(block_);
+		pos_ = std::max(pos_, block_ * POSTINGS_BLOCK);
+		const size_t end = block_ * POSTINGS_BLOCK + source_.block_size(block_);
+		if (source_.codec == postings_codec::raw) {
+			pos_ = std::lower_bound(source_.ids + pos_, source_.ids + end, target) - source_.ids;
+			return;
+		}
+		while (pos_ < end && doc_at(pos_) < target) ++pos_;
+	}
+
+	// moves only the block pointer, to the block that may contain target
+	void shallow_advance(doc_id target) {
+		size_t blocks = (source_.n + POSTINGS_BLOCK - 1) / POSTINGS_BLOCK;
+		while (block_ < blocks && source_.block_last[block_] < target) ++block_;
+	}
+
+	bool block_exhausted() const { return block_ * POSTINGS_BLOCK >= source_.n; }
+
+	doc_id block_last() const { return block_exhausted() ? END : source_.block_last[block_]; }
+
+	float block_max() const { return block_exhausted() ? 0.0f : block_max_[block_]; }
+};
+
+// Compressed-sparse-row inverted index. The postings of term t occupy
+// positions offsets_[t] .. offsets_[t + 1], sorted by document; the
+// per-posting weights sit at the same positions of weights_. With the raw
+// codec document ids are stored the same way in doc_ids_, otherwise they
+// are gap-encoded per block into encoded_ and doc_ids_ is released. Every
+// array can also be a view into a loaded index file.
+//
+// Optionally every posting also carries the token positions of its term in
+// its document, stored apart from the document ids so that queries which
+// do not need them never touch them: posting p's positions start at byte
+// position_data_[p] of positions_ as a varint count followed by varint
+// gaps.
+//
+// Scorers that precompute each posting's share of the score keep it,
+// quantized, in impacts_ at the same positions as the weights; the
+// weights stay, the impacts are derived from them.
+class postings_index {
+private:
+	postings_codec codec_ = postings_codec::raw;
+	stored_vector<uint32_t> offsets_;
+	stored_vector<doc_id> doc_ids_;
+	stored_vector<float> weights_;
+	stored_vector<uint8_t> encoded_;
+	// byte offset of every block in encoded_
+	stored_vector<uint32_t> block_data_;
+	// block-max metadata, the blocks of term t start at block_offsets_[t]
+	stored_vector<uint32_t> block_offsets_;
+	stored_vector<doc_id> block_last_;
+	stored_vector<float> block_max_;
+	stored_vector<float> max_impact_;
+	// empty unless build_impacts() ran since the postings last changed
+	stored_vector<uint16_t> impacts_;
+	// postings + 1 byte offsets into positions_, empty without positions
+	stored_vector<uint64_t> position_data_;
+	stored_vector<uint8_t> positions_;
+
+	static size_t block_count(size_t n) { return (n + POSTINGS_BLOCK - 1) / POSTINGS_BLOCK; }
+
+	// float rounding must not push a bound below the value it bounds
+	static float round_up(double x) {
+		float f = static_cast<float>(x);
+		return f < x ? std::nextafter(f, INFINITY) : f;
+	}
+
+	// splits the vocabulary into parts ranges of consecutive terms holding
+	// about the same number of postings
+	std::vector<size_t> term_ranges(size_t parts) const {
+		const size_t terms = vocabulary_size();
+		const size_t total = terms == 0 ? 0 : offsets_[terms];
+		std::vector<size_t> bounds(1, 0);
+		for (size_t p = 1; p < parts; ++p) {
+			size_t t = std::lower_bound(offsets_.begin(), offsets_.begin() + terms, (uint32_t)(total * p / parts)) - offsets_.begin();
+			bounds.push_back(std::max(bounds.back(), t));
+		}
+		bounds.push_back(terms);
+		return bounds;
+	}
+
+	// every worker encodes a range of terms into its own buffer, the buffers
+	// are then joined in term order, so the output does not depend on threads
+	void encode(size_t threads) {
+		auto& encoded = encoded_.reset();
+		auto& block_data = block_data_.reset();
+		block_data.assign(block_last_.size(), 0);
+		if (codec_ == postings_codec::raw) return;
+
+		const std::vector<size_t> ranges = term_ranges(threads);
+		std::vector<std::vector<uint8_t>> parts(ranges.size() - 1);
+		run_workers(parts.size(), [&](size_t w) {
+			doc_id gaps[POSTINGS_BLOCK];
+			for (size_t t = ranges[w]; t < ranges[w + 1]; ++t) {
+				const size_t n = size((term_id)t);
+				const doc_id* ids = doc_ids_.data() + offsets_[t];
+				for (size_t b = 0; b < block_count(n); ++b) {
+					const size_t begin = b * POSTINGS_BLOCK;
+					const size_t count = std::min(n, begin + POSTINGS_BLOCK) - begin;
+					doc_id prev = b == 0 ? 0 : ids[begin - 1];
+					for (size_t i = 0; i < count; ++i) {
+						gaps[i] = ids[begin + i] - prev;
+						prev = ids[begin + i];
+					}
+
+					block_data[block_offsets_[t] + b] = (uint32_t)parts[w].size();
+					if (codec_ == postings_codec::varint) codec::encode_varint(gaps, count, parts[w]);
+					else codec::encode_pfor(gaps, count, parts[w]);
+				}
+			}
+		});
+
+		size_t total = 0;
+		for (const auto& part : parts) total += part.size();
+		encoded.reserve(total);
+		for (size_t w = 0; w < parts.size(); ++w) {
+			const uint32_t base = (uint32_t)encoded.size();
+			for (size_t b = block_offsets_[ranges[w]]; b < block_offsets_[ranges[w + 1]]; ++b) block_data[b] += base;
+			encoded.insert(encoded.end(), parts[w].begin(), parts[w].end());
+			std::vector<uint8_t>().swap(parts[w]);
+		}
+		doc_ids_.clear();
+	}
+
+	// block metadata and encoding of freshly written offsets_ and doc_ids_
+	void finish(size_t threads) {
+		const size_t terms = vocabulary_size();
+		auto& block_offsets = block_offsets_.reset();
+		block_offsets.assign(terms + 1, 0);
+		for (size_t t = 0; t < terms; ++t) {
+			block_offsets[t + 1] = block_offsets[t] + (uint32_t)block_count(size((term_id)t));
+		}
+		auto& block_last = block_last_.reset();
+		block_last.resize(block_offsets[terms]);
+		for (size_t t = 0; t < terms; ++t) {
+			const size_t n = size((term_id)t);
+			for (size_t b = 0; b < block_count(n); ++b) {
+				block_last[block_offsets[t] + b] = doc_ids_[offsets_[t] + std::min(n, (b + 1) * POSTINGS_BLOCK) - 1];
+			}
+		}
+		block_max_.reset().assign(block_last.size(), 0.0f);
+		max_impact_.reset().assign(terms, 0.0f);
+		impacts_.clear();
+
+		encode(threads);
+	}
+
+	// plain arrays of an index being rewritten by update() or merge()
+	struct rewritten_postings {
+		std::vector<uint32_t> offsets;
+		std::vector<doc_id> doc_ids;
+		std::vector<float> weights;
+		std::vector<uint64_t> position_data;
+		std::vector<uint8_t> positions;
+	};
+
+	// appends the postings of t, shifted up by base and without those of
+	// removed documents, to out; renumbered, unless null, maps the shifted
+	// ids to the ones written
+	template <class removed_fn>
+	void copy_postings(term_id t, doc_id base, removed_fn removed, bool positional, rewritten_postings& out,
+		const std::vector<doc_id>* renumbered = nullptr) const {
+		if (t >= vocabulary_size()) return;
+		size_t p = offsets_[t];
+		scan(t, [&](doc_id d, float w) {
+			if (!removed(base + d)) {
+				out.doc_ids.push_back(renumbered != nullptr ? (*renumbered)[base + d] : base + d);
+				out.weights.push_back(w);
+				if (positional) {
+					out.position_data.push_back(out.positions.size());
+					out.positions.insert(out.positions.end(), positions_.data() + position_data_[p], positions_.data() + position_data_[p + 1]);
+				}
+			}
+			++p;
+		});
+	}
+
+	// makes out the contents of the index
+	void adopt(rewritten_postings& out, bool positional, size_t threads) {
+		if (positional) out.position_data.push_back(out.positions.size());
+		offsets_.reset().swap(out.offsets);
+		doc_ids_.reset().swap(out.doc_ids);
+		weights_.reset().swap(out.weights);
+		position_data_.reset().swap(out.position_data);
+		positions_.reset().swap(out.positions);
+		finish(threads);
+	}
+
+	postings_source source(term_id t) const {
+		postings_source s;
+		s.codec = codec_;
+		s.ids = codec_ == postings_codec::raw ? doc_ids_.data() + offsets_[t] : nullptr;
+		s.encoded = encoded_.data();
+		s.block_data = block_data_.data() + block_offsets_[t];
+		s.block_last = block_last_.data() + block_offsets_[t];
+		s.n = size(t);
+		return s;
+	}
+
+	// visit(doc, values[i]) for the i-th posting of t
+	template <class value_t, class visit_fn>
+	void scan_values(term_id t, const value_t* values, visit_fn visit) const {
+		const postings_source s = source(t);
+		if (codec_ == postings_codec::raw) {
+			for (size_t i = 0; i < s.n; ++i) visit(s.ids[i], values[i]);
+			return;
+		}
+
+		doc_id ids[POSTINGS_BLOCK];
+		for (size_t b = 0; b < block_count(s.n); ++b) {
+			s.decode_block(b, ids);
+			const value_t* block_values = values + b * POSTINGS_BLOCK;
+			for (size_t i = 0; i < s.block_size(b); ++i) visit(ids[i], block_values[i]);
+		}
+	}
+public:
+	// takes effect on the next build()
+	void set_codec(postings_codec codec) { codec_ = codec; }
+
+	postings_codec get_codec() const { return codec_; }
+
+	// docs[d] is the sorted (term id, tf) list of document d; weight maps a
+	// term frequency to the value stored with the posting and must be safe
+	// to call from several threads.
+	//
+	// Documents are sharded into contiguous id ranges. Every shard counts
+	// its own document frequencies, the partial counts are merged into the
+	// term offsets, and every shard then writes its postings into its own
+	// slice of each term's run. The slices follow shard order and shards
+	// follow id order, so the index is the same for any number of threads.
+	template <class weight_fn>
+	void build(const std::vector<const std::vector<term_count>*>& docs, size_t vocabulary_size, weight_fn weight, size_t threads = 1) {
+		const size_t shards = std::max<size_t>(1, std::min(threads, docs.size()));
+		auto shard_begin = [&](size_t s) { return docs.size() * s / shards; };
+
+		std::vector<std::vector<uint32_t>> fill(shards);
+		run_workers(shards, [&](size_t s) {
+			fill[s].assign(vocabulary_size, 0);
+			for (size_t d = shard_begin(s); d < shard_begin(s + 1); ++d) {
+				for (const auto& kv : *docs[d]) {
+					fill[s][kv.first] += 1;
+				}
+			}
+		});
+
+		// a shard's partial frequency becomes the start of its slice
+		auto& offsets = offsets_.reset();
+		offsets.assign(vocabulary_size + 1, 0);
+		for (size_t t = 0; t < vocabulary_size; ++t) {
+			uint32_t at = offsets[t];
+			for (size_t s = 0; s < shards; ++s) {
+				uint32_t n = fill[s][t];
+				fill[s][t] = at;
+				at += n;
+			}
+			offsets[t + 1] = at;
+		}
+
+		auto& doc_ids = doc_ids_.reset();
+		auto& weights = weights_.reset();
+		doc_ids.resize(offsets[vocabulary_size]);
+		weights.resize(offsets[vocabulary_size]);
+
+		run_workers(shards, [&](size_t s) {
+			for (size_t d = shard_begin(s); d < shard_begin(s + 1); ++d) {
+				for (const auto& kv : *docs[d]) {
+					uint32_t at = fill[s][kv.first]++;
+					doc_ids[at] = (doc_id)d;
+					weights[at] = weight(kv.second);
+				}
+			}
+		});
+		std::vector<std::vector<uint32_t>>().swap(fill);
+
+		position_data_.clear();
+		positions_.clear();
+		finish(threads);
+	}
+
+	// Rewrites the index with the postings of removed documents dropped and
+	// those of docs appended, docs[i] being document first + i; first has
+	// to be past every document already indexed. Bounds start over at zero,
+	// build_bounds() has to run again. If positional, positions(i, j) gives
+	// the positions of the j-th term of docs[i] as in build_positions();
+	// an index that has positions has to stay positional.
+	template <class removed_fn, class weight_fn, class positions_fn>
+	void update(const std::vector<const std::vector<term_count>*>& docs, doc_id first, size_t vocabulary_size,
+		removed_fn removed, weight_fn weight, bool positional, positions_fn positions, size_t threads = 1) {
+		const size_t old_terms = this->vocabulary_size();
+
+		// the new postings of every term, bucketed by term: (document, index of the term in it)
+		std::vector<uint32_t> added_offsets(vocabulary_size + 1, 0);
+		for (size_t i = 0; i < docs.size(); ++i) {
+			if (removed((doc_id)(first + i))) continue;
+			for (const auto& kv : *docs[i]) added_offsets[kv.first + 1] += 1;
+		}
+		for (size_t t = 0; t < vocabulary_size; ++t) added_offsets[t + 1] += added_offsets[t];
+		std::vector<std::pair<uint32_t, uint32_t>> added(added_offsets[vocabulary_size]);
+		{
+			std::vector<uint32_t> fill(added_offsets.begin(), added_offsets.end() - 1);
+			for (size_t i = 0; i < docs.size(); ++i) {
+				if (removed((doc_id)(first + i))) continue;
+				for (size_t j = 0; j < docs[i]->size(); ++j) added[fill[(*docs[i])[j].first]++] = { (uint32_t)i, (uint32_t)j };
+			}
+		}
+
+		rewritten_postings out;
+		out.offsets.assign(vocabulary_size + 1, 0);
+		for (size_t t = 0; t < vocabulary_size; ++t) {
+			if (t < old_terms) copy_postings((term_id)t, 0, removed, positional, out);
+			for (size_t a = added_offsets[t]; a < added_offsets[t + 1]; ++a) {
+				const auto [i, j] = added[a];
+				out.doc_ids.push_back((doc_id)(first + i));
+				out.weights.push_back(weight((*docs[i])[j].second));
+				if (positional) {
+					const auto [at, n] = positions(i, j);
+					out.position_data.push_back(out.positions.size());
+					codec::put_varint(out.positions, (uint32_t)n);
+					uint32_t prev = 0;
+					for (size_t k = 0; k < n; ++k) {
+						codec::put_varint(out.positions, at[k] - prev);
+						prev = at[k];
+					}
+				}
+			}
+			out.offsets[t + 1] = (uint32_t)out.doc_ids.size();
+		}
+		adopt(out, positional, threads);
+	}
+
+	// Makes this index the concatenation of parts, the documents of
+	// parts[i] shifted up by bases[i]; every part's shifted ids have to lie
+	// past those of the part before. Postings of documents for which
+	// removed(d) holds, d being the shifted id, are dropped. renumbered,
+	// unless null, gives the id of every shifted one in the result and
+	// must keep their order. Positions are kept if every part has them.
+	// Bounds start at zero as after update().
+	template <class removed_fn>
+	void merge(const std::vector<const postings_index*>& parts, const std::vector<doc_id>& bases, size_t vocabulary_size,
+		removed_fn removed, size_t threads = 1, const std::vector<doc_id>* renumbered = nullptr) {
+		bool positional = !parts.empty();
+		for (const postings_index* part : parts) positional = positional && part->has_positions();
+
+		rewritten_postings out;
+		out.offsets.assign(vocabulary_size + 1, 0);
+		for (size_t t = 0; t < vocabulary_size; ++t) {
+			for (size_t i = 0; i < parts.size(); ++i) parts[i]->copy_postings((term_id)t, bases[i], removed, positional, out, renumbered);
+			out.offsets[t + 1] = (uint32_t)out.doc_ids.size();
+		}
+		adopt(out, positional, threads);
+	}
+
+	// Sets the quantized impact of every posting to impact(term, doc,
+	// weight), and the per-term and per-block bounds to the largest of
+	// them, as build_bounds() does for computed impacts.
+	template <class impact_fn>
+	void build_impacts(impact_fn impact, size_t threads = 1) {
+		auto& impacts = impacts_.reset();
+		const size_t terms = vocabulary_size();
+		impacts.resize(terms == 0 ? 0 : offsets_[terms]);
+		auto& block_maxes = block_max_.edit();
+		auto& max_impact = max_impact_.edit();
+		const std::vector<size_t> ranges = term_ranges(threads);
+		run_workers(ranges.size() - 1, [&](size_t w) {
+			doc_id ids[POSTINGS_BLOCK];
+			for (size_t t = ranges[w]; t < ranges[w + 1]; ++t) {
+				const postings_source s = source((term_id)t);
+				const float* weights = weights_.data() + offsets_[t];
+				uint16_t* term_impacts = impacts.data() + offsets_[t];
+				uint16_t term_max = 0;
+				for (size_t b = 0; b < block_count(s.n); ++b) {
+					s.decode_block(b, ids);
+					uint16_t block_max = 0;
+					for (size_t i = 0; i < s.block_size(b); ++i) {
+						const size_t p = b * POSTINGS_BLOCK + i;
+						term_impacts[p] = impact((term_id)t, ids[i], weights[p]);
+						block_max = std::max(block_max, term_impacts[p]);
+					}
+					block_maxes[block_offsets_[t] + b] = block_max;
+					term_max = std::max(term_max, block_max);
+				}
+				max_impact[t] = term_max;
+			}
+		});
+	}
+
+	// Adds token positions to the postings made by the last build().
+	// positions(d, i) returns the ascending positions of the i-th term of
+	// docs[d] as (pointer, count). Like encode(), every worker writes a
+	// range of terms into its own buffer and the buffers are joined in term
+	// order.
+	template <class positions_fn>
+	void build_positions(const std::vector<const std::vector<term_count>*>& docs, positions_fn positions, size_t threads = 1) {
+		auto& all = positions_.reset();
+		auto& position_data = position_data_.reset();
+		const size_t terms = vocabulary_size();
+		const size_t postings = terms == 0 ? 0 : offsets_[terms];
+		position_data.assign(postings + 1, 0);
+
+		const std::vector<size_t> ranges = term_ranges(threads);
+		std::vector<std::vector<uint8_t>> parts(ranges.size() - 1);
+		run_workers(parts.size(), [&](size_t w) {
+			for (size_t t = ranges[w]; t < ranges[w + 1]; ++t) {
+				size_t p = offsets_[t];
+				scan((term_id)t, [&](doc_id d, float) {
+					const auto& doc_terms = *docs[d];
+					const size_t i = std::lower_bound(doc_terms.begin(), doc_terms.end(), term_count((term_id)t, 0)) - doc_terms.begin();
+					const auto [at, n] = positions(d, i);
+					position_data[p++] = parts[w].size();
+					codec::put_varint(parts[w], (uint32_t)n);
+					uint32_t prev = 0;
+					for (size_t j = 0; j < n; ++j) {
+						codec::put_varint(parts[w], at[j] - prev);
+						prev = at[j];
+					}
+				});
+			}
+		});
+
+		size_t total = 0;
+		for (const auto& part : parts) total += part.size();
+		all.reserve(total);
+		for (size_t w = 0; w < parts.size(); ++w) {
+			const uint64_t base = all.size();
+			for (size_t p = offsets_[ranges[w]]; p < offsets_[ranges[w + 1]]; ++p) position_data[p] += base;
+			all.insert(all.end(), parts[w].begin(), parts[w].end());
+			std::vector<uint8_t>().swap(parts[w]);
+		}
+		position_data[postings] = all.size();
+	}
+
+	// Fills the per-term and per-block upper bounds used for dynamic pruning;
+	// impact(doc, weight) is the score contribution of one posting.
+	template <class impact_fn>
+	void build_bounds(impact_fn impact, size_t threads = 1) {
+		auto& block_maxes = block_max_.edit();
+		auto& max_impact = max_impact_.edit();
+		const std::vector<size_t> ranges = term_ranges(threads);
+		run_workers(ranges.size() - 1, [&](size_t w) {
+			doc_id ids[POSTINGS_BLOCK];
+			for (size_t t = ranges[w]; t < ranges[w + 1]; ++t) {
+				const postings_source s = source((term_id)t);
+				const float* weights = weights_.data() + offsets_[t];
+				double term_max = 0.0;
+				for (size_t b = 0; b < block_count(s.n); ++b) {
+					s.decode_block(b, ids);
+					double block_max = 0.0;
+					for (size_t i = 0; i < s.block_size(b); ++i) {
+						block_max = std::max(block_max, (double)impact(ids[i], weights[b * POSTINGS_BLOCK + i]));
+					}
+					block_maxes[block_offsets_[t] + b] = round_up(block_max);
+					term_max = std::max(term_max, block_max);
+				}
+				max_impact[t] = round_up(term_max);
+			}
+		});
+	}
+
+	void clear() {
+		offsets_.clear();
+		doc_ids_.clear();
+		weights_.clear();
+		encoded_.clear();
+		block_data_.clear();
+		block_offsets_.clear();
+		block_last_.clear();
+		block_max_.clear();
+		max_impact_.clear();
+		impacts_.clear();
+		position_data_.clear();
+		positions_.clear();
+	}
+
+	void save(index_file_writer& out) const {
+		out.add_copy(section_tag("PCDC"), std::vector<uint32_t>{ (uint32_t)codec_ });
+		out.add(section_tag("POFF"), offsets_);
+		out.add(section_tag("PDOC"), doc_ids_);
+		out.add(section_tag("PWGT"), weights_);
+		out.add(section_tag("PENC"), encoded_);
+		out.add(section_tag("PBDT"), block_data_);
+		out.add(section_tag("PBOF"), block_offsets_);
+		out.add(section_tag("PBLS"), block_last_);
+		out.add(section_tag("PBMX"), block_max_);
+		out.add(section_tag("PMAX"), max_impact_);
+		out.add(section_tag("PIMP"), impacts_);
+		out.add(section_tag("PPOF"), position_data_);
+		out.add(section_tag("PPOS"), positions_);
+	}
+
+	// views the arrays in place; false if a section is missing or the
+	// arrays do not fit together
+	bool load(const mapped_index_file& in) {
+		const uint32_t* codec = nullptr;
+		size_t n = 0;
+		if (!in.find(section_tag("PCDC"), codec, n) || n != 1 || *codec > (uint32_t)postings_codec::pfor) return false;
+		codec_ = (postings_codec)*codec;
+		if (!in.view(section_tag("POFF"), offsets_) || !in.view(section_tag("PDOC"), doc_ids_) ||
+			!in.view(section_tag("PWGT"), weights_) || !in.view(section_tag("PENC"), encoded_) ||
+			!in.view(section_tag("PBDT"), block_data_) || !in.view(section_tag("PBOF"), block_offsets_) ||
+			!in.view(section_tag("PBLS"), block_last_) || !in.view(section_tag("PBMX"), block_max_) ||
+			!in.view(section_tag("PMAX"), max_impact_) || !in.view(section_tag("PIMP"), impacts_) ||
+			!in.view(section_tag("PPOF"), position_data_) || !in.view(section_tag("PPOS"), positions_)) return false;
+
+		const size_t terms = vocabulary_size();
+		if (offsets_.empty() || block_offsets_.size() != terms + 1 || max_impact_.size() != terms) return false;
+		const size_t postings = offsets_[terms];
+		const size_t blocks = block_offsets_[terms];
+		if (weights_.size() != postings || block_last_.size() != blocks || block_max_.size() != blocks) return false;
+		if (!impacts_.empty() && impacts_.size() != postings) return false;
+		if (codec_ == postings_codec::raw ? doc_ids_.size() != postings : block_data_.size() != blocks) return false;
+		for (size_t t = 0; t < terms; ++t) {
+			if (offsets_[t] > offsets_[t + 1] || block_offsets_[t + 1] - block_offsets_[t] != block_count(size((term_id)t))) return false;
+		}
+		for (size_t b = 0; codec_ != postings_codec::raw && b < blocks; ++b) {
+			if (block_data_[b] >= encoded_.size()) return false;
+		}
+		if (has_positions()) {
+			if (position_data_.size() != postings + 1 || position_data_[postings] != positions_.size()) return false;
+			for (size_t p = 0; p < postings; ++p) {
+				if (position_data_[p] >= position_data_[p + 1]) return false;
+			}
+		}
+		return true;
+	}
+
+	size_t vocabulary_size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+
+	// number of documents containing t
+	size_t size(term_id t) const {
+		if (t >= vocabulary_size()) return 0;
+		return offsets_[t + 1] - offsets_[t];
+	}
+
+	// calls visit(doc, weight) for every posting of t, block by block
+	template <class visit_fn>
+	void scan(term_id t, visit_fn visit) const {
+		if (t >= vocabulary_size()) return;
+		scan_values(t, weights_.data() + offsets_[t], visit);
+	}
+
+	// calls visit(doc, impact) for every posting of t; the index must have
+	// impacts
+	template <class visit_fn>
+	void scan_impacts(term_id t, visit_fn visit) const {
+		if (t >= vocabulary_size()) return;
+		scan_values(t, impacts_.data() + offsets_[t], visit);
+	}
+
+	bool has_impacts() const { return !impacts_.empty(); }
+
+	bool has_positions() const { return !position_data_.empty(); }
+
+	// ascending token positions of t in document d, false if d does not
+	// contain t or the index has no positions
+	bool positions(term_id t, doc_id d, std::vector<uint32_t>& out) const {
+		out.clear();
+		if (!has_positions() || t >= vocabulary_size()) return false;
+		const postings_source s = source(t);
+		const size_t blocks = block_count(s.n);
+		const size_t b = std::lower_bound(s.block_last, s.block_last + blocks, d) - s.block_last;
+		if (b == blocks) return false;
+
+		const size_t begin = b * POSTINGS_BLOCK;
+		const size_t count = s.block_size(b);
+		doc_id buffer[POSTINGS_BLOCK];
+		const doc_id* ids = buffer;
+		if (codec_ == postings_codec::raw) ids = s.ids + begin;
+		else s.decode_block(b, buffer);
+		const size_t i = std::lower_bound(ids, ids + count, d) - ids;
+		if (i == count || ids[i] != d) return false;
+
+		const uint8_t* in = positions_.data() + position_data_[offsets_[t] + begin + i];
+		out.resize(codec::get_varint(in));
+		uint32_t position = 0;
+		for (auto& p : out) {
+			position += codec::get_varint(in);
+			p = position;
+		}
+		return true;
+	}
+
+	// upper bound of impact() over all postings of t
+	float max_impact(term_id t) const { return t < max_impact_.size() ? max_impact_[t] : 0.0f; }
+
+	// the bounds of build_bounds(), per block and per term, for saving
+	// them apart from the postings
+	const stored_vector<float>& block_maxima() const { return block_max_; }
+
+	const stored_vector<float>& max_impacts() const { return max_impact_; }
+
+	// views bounds saved from block_maxima() and max_impacts(); false if
+	// they do not fit the postings
+	bool view_bounds(const float* block_max, size_t blocks, const float* max_impact, size_t terms) {
+		if (blocks != block_last_.size() || terms != vocabulary_size()) return false;
+		block_max_.view(block_max, blocks);
+		max_impact_.view(max_impact, terms);
+		return true;
+	}
+
+	// the impacts of build_impacts(), empty without them
+	const stored_vector<uint16_t>& impacts() const { return impacts_; }
+
+	// views impacts saved from impacts(), none or one per posting; false if
+	// they do not fit the postings
+	bool view_impacts(const uint16_t* impacts, size_t n) {
+		const size_t terms = vocabulary_size();
+		if (n != 0 && n != (terms == 0 ? 0 : offsets_[terms])) return false;
+		impacts_.view(impacts, n);
+		return true;
+	}
+
+	postings_cursor cursor(term_id t) const {
+		if (t >= vocabulary_size()) return postings_cursor();
+		return postings_cursor(source(t), weights_.data() + offsets_[t], has_impacts() ? impacts_.data() + offsets_[t] : nullptr,
+			block_max_.data() + block_offsets_[t]);
+	}
+
+	// storage taken by the document ids alone, raw array or encoded blocks
+	size_t get_doc_id_bytes() const {
+		if (codec_ == postings_codec::raw) return doc_ids_.size() * sizeof(doc_id);
+		return encoded_.size() + block_data_.size() * sizeof(uint32_t);
+	}
+
+	size_t get_bytes_count() const {
+		size_t bytes = sizeof(*this);
+		bytes += offsets_.get_bytes_count();
+		bytes += doc_ids_.get_bytes_count();
+		bytes += weights_.get_bytes_count();
+		bytes += encoded_.get_bytes_count();
+		bytes += block_data_.get_bytes_count();
+		bytes += block_offsets_.get_bytes_count();
+		bytes += block_last_.get_bytes_count();
+		bytes += block_max_.get_bytes_count();
+		bytes += max_impact_.get_bytes_count();
+		bytes += impacts_.get_bytes_count();
+		bytes += position_data_.get_bytes_count();
+		bytes += positions_.get_bytes_count();
+		return bytes;
+	}
+};
@@ -0,0 +1,334 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#define RADIX_TRIE_NIL 0u
+
+// Path-compressed trie node. The edge leading into a node carries a whole
+// label, stored as a slice of the trie's shared labels buffer, so a chain of
+// single-child nodes ("intern" -> "internation") collapses into one node.
+// Children form a sibling list ordered by the first letter of their label.
+struct radix_trie_node {
+    uint32_t label = 0;
+    uint32_t len = 0;
+    uint32_t child = RADIX_TRIE_NIL;
+    uint32_t next = RADIX_TRIE_NIL;
+    uint32_t count = 0;
+    uint32_t id = 0;
+    bool is_term = false;
+
+    bool is_leaf() const { return child == RADIX_TRIE_NIL; }
+};
+
+class radix_trie {
+private:
+    std::vector<radix_trie_node> nodes;
+    std::vector<char> labels;
+    std::vector<uint32_t> free_nodes;
+
+    uint32_t _alloc_node() {
+        if (!free_nodes.empty()) {
+            uint32_t idx = free_nodes.back();
+            free_nodes.pop_back();
+            nodes[idx] = radix_trie_node();
+            return idx;
+        }
+
+        nodes.emplace_back();
+        return (uint32_t)(nodes.size() - 1);
+    }
+
+    uint32_t _push_label(const char* s, size_t n) {
+        uint32_t off = (uint32_t)labels.size();
+        labels.insert(labels.end(), s, s + n);
+        return off;
+    }
+
+    void _ensure_root() {
+        if (nodes.empty()) {
+            nodes.emplace_back();
+        }
+    }
+
+    // returns the child of parent whose label starts with sym, prev receives
+    // its left sibling (or RADIX_TRIE_NIL) so callers can relink the list
+    uint32_t _child(uint32_t parent, char sym, uint32_t& prev) const {
+        prev = RADIX_TRIE_NIL;
+        uint32_t cur = nodes[parent].child;
+        while (cur != RADIX_TRIE_NIL) {
+            char first = labels[nodes[cur].label];
+            if (first == sym) {
+                return cur;
+            }
+            if (first > sym) {
+                break;
+            }
+            prev = cur;
+            cur = nodes[cur].next;
+        }
+        return RADIX_TRIE_NIL;
+    }
+
+    void _link_child(uint32_t parent, uint32_t node) {
+        char sym = labels[nodes[node].label];
+        uint32_t prev = RADIX_TRIE_NIL;
+        uint32_t cur = nodes[parent].child;
+        while (cur != RADIX_TRIE_NIL && labels[nodes[cur].label] < sym) {
+            prev = cur;
+            cur = nodes[cur].next;
+        }
+
+        nodes[node].next = cur;
+        if (prev == RADIX_TRIE_NIL) {
+            nodes[parent].child = node;
+        }
+        else {
+            nodes[prev].next = node;
+        }
+    }
+
+    size_t _common_prefix(const radix_trie_node& node, const std::string& stem, size_t i) const {
+        size_t k = 0;
+        while (k < node.len && i + k < stem.size() && labels[node.label + k] == stem[i + k]) {
+            k++;
+        }
+        return k;
+    }
+
+    uint32_t _find(const std::string& stem) const {
+        if (nodes.empty()) {
+            return RADIX_TRIE_NIL;
+        }
+
+        uint32_t cur = 0;
+        size_t i = 0;
+        while (i < stem.size()) {
+            uint32_t prev;
+            uint32_t next = _child(cur, stem[i], prev);
+            if (next == RADIX_TRIE_NIL) {
+                return RADIX_TRIE_NIL;
+            }
+
+            size_t k = _common_prefix(nodes[next], stem, i);
+            if (k != nodes[next].len) {
+                return RADIX_TRIE_NIL;
+            }
+            i += k;
+            cur = next;
+        }
+
+        return cur;
+    }
+
+    uint32_t _insert(const std::string& stem) {
+        _ensure_root();
+
+        uint32_t cur = 0;
+        size_t i = 0;
+        while (i < stem.size()) {
+            uint32_t prev;
+            uint32_t next = _child(cur, stem[i], prev);
+
+            if (next == RADIX_TRIE_NIL) {
+                uint32_t leaf = _alloc_node();
+                nodes[leaf].label = _push_label(stem.data() + i, stem.size() - i);
+                nodes[leaf].len = (uint32_t)(stem.size() - i);
+                _link_child(cur, leaf);
+                cur = leaf;
+                break;
+            }
+
+            size_t k = _common_prefix(nodes[next], stem, i);
+            if (k < nodes[next].len) {
+                // split the edge: next keeps the shared head of its label,
+                // a new node takes over the tail together with next's payload
+                uint32_t tail = _alloc_node();
+                radix_trie_node& head = nodes[next];
+                nodes[tail].label = head.label + (uint32_t)k;
+                nodes[tail].len = head.len - (uint32_t)k;
+                nodes[tail].child = head.child;
+                nodes[tail].count = head.count;
+                nodes[tail].id = head.id;
+                nodes[tail].is_term = head.is_term;
+
+                head.len = (uint32_t)k;
+                head.child = tail;
+                head.count = 0;
+                head.is_term = false;
+            }
+
+            i += k;
+            cur = next;
+        }
+
+        nodes[cur].count += 1;
+        nodes[cur].is_term = true;
+        return cur;
+    }
+
+    // folds the single child of idx into idx, concatenating the labels
+    void _merge_with_child(uint32_t idx) {
+        uint32_t only = nodes[idx].child;
+        radix_trie_node& node = nodes[idx];
+        const radix_trie_node& tail = nodes[only];
+
+        if (node.label + node.len != tail.label) {
+            std::string joined(labels.data() + node.label, node.len);
+            joined.append(labels.data() + tail.label, tail.len);
+            node.label = _push_label(joined.data(), joined.size());
+        }
+        node.len += tail.len;
+        node.child = tail.child;
+        node.count = tail.count;
+        node.id = tail.id;
+        node.is_term = tail.is_term;
+        free_nodes.push_back(only);
+    }
+
+    void _erase(const std::string& stem) {
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> path;
+        std::vector<uint32_t> left;
+        path.push_back(0);
+
+        size_t i = 0;
+        while (i < stem.size()) {
+            uint32_t prev;
+            uint32_t next = _child(path.back(), stem[i], prev);
+            if (next == RADIX_TRIE_NIL) {
+                return;
+            }
+            size_t k = _common_prefix(nodes[next], stem, i);
+            if (k != nodes[next].len) {
+                return;
+            }
+            path.push_back(next);
+            left.push_back(prev);
+            i += k;
+        }
+
+        uint32_t idx = path.back();
+        if (nodes[idx].count == 0) {
+            return;
+        }
+        nodes[idx].count -= 1;
+        if (nodes[idx].count != 0 || idx == 0) {
+            return;
+        }
+        nodes[idx].is_term = false;
+
+        uint32_t parent = path[path.size() - 2];
+        if (nodes[idx].is_leaf()) {
+            uint32_t prev = left.back();
+            if (prev == RADIX_TRIE_NIL) {
+                nodes[parent].child = nodes[idx].next;
+            }
+            else {
+                nodes[prev].next = nodes[idx].next;
+            }
+            free_nodes.push_back(idx);
+
+            // the parent may now be a pass-through node with a single child
+            const radix_trie_node& p = nodes[parent];
+            if (parent != 0 && !p.is_term && !p.is_leaf() && nodes[p.child].next == RADIX_TRIE_NIL) {
+                _merge_with_child(parent);
+            }
+        }
+        else if (nodes[nodes[idx].child].next == RADIX_TRIE_NIL) {
+            _merge_with_child(idx);
+        }
+    }
+
+    void traverse(std::unordered_map<std::string, int>& tf_map, uint32_t root, std::string& temp) const {
+        for (uint32_t c = nodes[root].child; c != RADIX_TRIE_NIL; c = nodes[c].next) {
+            const radix_trie_node& node = nodes[c];
+            temp.append(labels.data() + node.label, node.len);
+            traverse(tf_map, c, temp);
+            if (node.is_term == true) {
+                tf_map.insert(std::make_pair(temp, (int)node.count));
+            }
+            temp.resize(temp.size() - node.len);
+        }
+    }
+public:
+    radix_trie() { _ensure_root(); }
+
+    radix_trie(std::vector<std::string>& list) {
+        _ensure_root();
+
+        for (auto& s : list)
+            insert(s);
+    }
+
+    ~radix_trie() { clear(); }
+
+    const radix_trie_node* find(const std::string& stem) const {
+        uint32_t idx = _find(stem);
+        if (idx == RADIX_TRIE_NIL && (nodes.empty() || !stem.empty())) {
+            return nullptr;
+        }
+        return &nodes[idx];
+    }
+
+    radix_trie_node* insert(const std::string& stem) { return &nodes[_insert(stem)]; }
+
+    void erase(const std::string& stem) { _erase(stem); }
+
+    bool empty() const { return nodes.empty() || nodes[0].is_leaf(); }
+
+    bool contains(const std::string& stem) const {
+        const radix_trie_node* node = find(stem);
+        return node != nullptr && node->count != 0;
+    }
+
+    size_t count(const std::string& stem) const {
+        const radix_trie_node* node = find(stem);
+        return node == nullptr ? 0 : node->count;
+    }
+
+    size_t count(const std::vector<std::string>& stems) const {
+        size_t ans = 0;
+
+        for (size_t i = 0; i < stems.size(); i++) {
+            ans += count(stems[i]);
+        }
+
+        return ans;
+    }
+
+    std::unordered_map<std::string, int> get_tf_map() const {
+        std::unordered_map<std::string, int> tf_map;
+        if (nodes.empty()) {
+            return tf_map;
+        }
+        std::string temp = "";
+        traverse(tf_map, 0, temp);
+        return tf_map;
+    }
+
+    size_t get_node_count() const { return nodes.size() - free_nodes.size(); }
+
+    void shrink_to_fit() {
+        nodes.shrink_to_fit();
+        labels.shrink_to_fit();
+    }
+
+    void clear() {
+        std::vector<radix_trie_node>().swap(nodes);
+        std::vector<char>().swap(labels);
+        std::vector<uint32_t>().swap(free_nodes);
+    }
+
+    size_t get_bytes_count() const {
+        size_t bytes = 0;
+        bytes += nodes.capacity() * sizeof(radix_trie_node);
+        bytes += labels.capacity() * sizeof(char);
+        bytes += free_nodes.capacity() * sizeof(uint32_t);
+        bytes += sizeof(*this);
+        return bytes;
+    }
+};
@@ -3,91 +3,277 @@
 #include <unordered_map>
 #include <algorithm>
 #include <cmath>
-#include <unordered_set>
-#include "indexation.cpp"
+#include "postings.cpp"
 
-using term = std::string;
-using tf_map = std::unordered_map<term, int>;
-using weight_vector = std::unordered_map<term, double>;
+using term = term_id;
+// sparse vector of (term id, weight), sorted by term id
+using weight_vector = std::vector<std::pair<term, double>>;
 using score_pair = std::pair<double, size_t>;
 
+// exhaustive: term-at-a-time over every posting of every query term
+// wand / block_max_wand: document-at-a-time with dynamic pruning, same top-k
+enum class retrieval_mode { exhaustive, wand, block_max_wand };
+
+// relative slack on pruning bounds, absorbs rounding differences between a
+// summed bound and the exact score computed for the same document
+#define BOUND_SLACK 1e-9
+
+// With positions, a document's score is multiplied by
+// 1 + PROXIMITY_WEIGHT * proximity, proximity being in [0, 1]; see
+// proximity(). Plain queries rerank the best PROXIMITY_RERANK * k
+// documents of the non-positional pass.
+#define PROXIMITY_WEIGHT 0.5
+#define PROXIMITY_RERANK 4
+
+// largest quantized BM25 impact, see scorer::impact_scale()
+#define BM25_IMPACT_MAX 65535
+
+// cosine: log-scaled tf times smoothed idf, document and query vectors
+// both L2-normalized
+// bm25: Okapi BM25; every posting's share of the score is computed ahead
+// of time and quantized to an integer, a query only adds them up
+enum class scoring_model { cosine, bm25 };
+
+// The parts of scoring that differ between models. search_ranker asks it
+// what to store with a posting, what a term's idf is and, under bm25,
+// what a posting is worth; the rest follows from the model.
+struct scorer {
+	scoring_model model = scoring_model::cosine;
+	// bm25 term frequency saturation and document length normalization
+	double k1 = 1.2;
+	double b = 0.75;
+
+	bool uses_impacts() const { return model == scoring_model::bm25; }
+
+	// what a posting of the given term frequency stores: the log-scaled tf,
+	// or the tf itself, which bm25 impacts are computed from
+	float posting_weight(uint32_t frequency) const {
+		if (uses_impacts()) return static_cast<float>(frequency);
+		return static_cast<float>(1.0 + std::log(static_cast<double>(frequency)));
+	}
+
+	// 0.0 for a term that occurs in no document
+	double inverse_document_frequency(size_t document_frequency, size_t total_documents) const {
+		if (document_frequency == 0) return 0.0;
+		const double df = static_cast<double>(document_frequency);
+		if (uses_impacts()) return std::log(1.0 + (static_cast<double>(total_documents) - df + 0.5) / (df + 0.5));
+		return std::log(static_cast<double>(total_documents) / (1.0 + df)) + 1.0;
+	}
+
+	// bm25 share of a term occurring frequency times in a document of the
+	// given length, always below idf * (k1 + 1)
+	double bm25(double idf, double frequency, double length, double average_length) const {
+		const double relative_length = average_length > 0.0 ? length / average_length : 1.0;
+		return idf * frequency * (k1 + 1.0) / (frequency + k1 * (1.0 - b + b * relative_length));
+	}
+
+	// Factor from bm25() to quantized impacts. It only depends on the
+	// largest idf, so segments rescored with the same idf quantize alike.
+	double impact_scale(const stored_vector<double>& idf) const {
+		double largest = 0.0;
+		for (double x : idf) largest = std::max(largest, x);
+		return largest > 0.0 ? BM25_IMPACT_MAX / (largest * (k1 + 1.0)) : 0.0;
+	}
+};
+
+// higher score first, ties go to the lower document id
+static bool ranks_before(const score_pair& a, const score_pair& b) {
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+// Keeps the best k results seen so far in a bounded heap whose root is the
+// weakest kept result, i.e. the score a new document has to beat.
+class top_k_results {
+private:
+	size_t k_;
+	std::vector<score_pair> heap_;
+public:
+	explicit top_k_results(size_t k) : k_(k) { heap_.reserve(k); }
+
+	bool full() const { return k_ != 0 && heap_.size() == k_; }
+
+	double threshold() const { return heap_.front().first; }
+
+	bool push(double score, size_t doc) {
+		if (k_ == 0) return false;
+		score_pair entry(score, doc);
+		if (heap_.size() < k_) {
+			heap_.push_back(entry);
+			std::push_heap(heap_.begin(), heap_.end(), ranks_before);
+			return true;
+		}
+		if (!ranks_before(entry, heap_.front())) return false;
+		std::pop_heap(heap_.begin(), heap_.end(), ranks_before);
+		heap_.back() = entry;
+		std::push_heap(heap_.begin(), heap_.end(), ranks_before);
+		return true;
+	}
+
+	// best first
+	std::vector<score_pair> take() {
+		std::sort_heap(heap_.begin(), heap_.end(), ranks_before);
+		return std::move(heap_);
+	}
+};
+
 class search_ranker {
 private:
-	std::vector<tf_map> docs_tf_;
-	std::vector<weight_vector> document_vectors_;
-	std::unordered_map<term, double> idf_;
-	std::unordered_map<term, std::vector<size_t>> inverted_index_;
+	std::vector<const std::vector<term_count>*> docs_tf_;
+	scorer scorer_;
+	// indexed by term id, 0.0 for terms that occur in no document
+	stored_vector<double> idf_;
+	// L2 norm of every document's tf-idf vector; under bm25 the document's
+	// length in tokens
+	stored_vector<double> doc_norms_;
+	// per-posting weight is the log-scaled tf, idf and the document norm are
+	// applied at query time; under bm25 it is the tf and queries add up the
+	// postings' impacts
+	postings_index postings_;
+	size_t build_threads_ = 1;
+	bool store_positions_ = false;
+	// Document updates. df_ follows every add and remove at once; the
+	// postings, idf, norms and bounds only catch up in apply_updates().
+	// Removed documents keep their ids, with removed_ set and a zero norm.
+	std::vector<uint32_t> df_;
+	stored_vector<uint8_t> removed_;
+	size_t live_documents_ = 0;
+	std::vector<const doc_t*> added_;
+	bool updates_pending_ = false;
+
+	float tf_weight(uint32_t frequency) const { return scorer_.posting_weight(frequency); }
 
 	void calculate_idf() {
-		std::unordered_map<term, int> document_frequency;
+		auto& idf = idf_.edit();
+		for (size_t t = 0; t < idf.size(); ++t) idf[t] = scorer_.inverse_document_frequency(df_[t], live_documents_);
+	}
 
-		for (const auto& term_frequencies : docs_tf_) {
-			for (const auto& kv : term_frequencies) {
-				document_frequency[kv.first] += 1;
+	void calculate_document_norms() {
+		auto& doc_norms = doc_norms_.reset();
+		doc_norms.resize(docs_tf_.size());
+
+		const size_t workers = std::max<size_t>(1, std::min(build_threads_, docs_tf_.size()));
+		run_workers(workers, [&](size_t w) {
+			for (size_t d = docs_tf_.size() * w / workers; d < docs_tf_.size() * (w + 1) / workers; ++d) {
+				double squared_norm = 0.0;
+				for (const auto& [term, freq] : *docs_tf_[d]) {
+					const double term_weight = tf_weight(freq) * idf_[term];
+					squared_norm += term_weight * term_weight;
+				}
+				doc_norms[d] = std::sqrt(squared_norm);
 			}
+		});
+	}
+
+	// same sums as calculate_document_norms(), taken from the postings as
+	// there are no forward lists after a load; per document the terms are
+	// still added in id order
+	void calculate_document_norms_from_postings() {
+		auto& doc_norms = doc_norms_.reset();
+		doc_norms.assign(removed_.size(), 0.0);
+		for (size_t t = 0; t < postings_.vocabulary_size(); ++t) {
+			const double idf = idf_[t];
+			postings_.scan((term)t, [&](doc_id d, float weight) {
+				const double term_weight = weight * idf;
+				doc_norms[d] += term_weight * term_weight;
+			});
 		}
+		for (auto& norm : doc_norms) norm = std::sqrt(norm);
+	}
 
-		idf_.clear();
-		idf_.reserve(document_frequency.size());
-		const double total_documents = static_cast<double>(docs_tf_.size());
+	// bm25: the length of every document, the sum of its postings' tf
+	void calculate_document_lengths_from_postings() {
+		auto& lengths = doc_norms_.reset();
+		lengths.assign(removed_.size(), 0.0);
+		for (size_t t = 0; t < postings_.vocabulary_size(); ++t) {
+			postings_.scan((term)t, [&](doc_id d, float weight) { lengths[d] += weight; });
+		}
+	}
 
-		for (const auto& kv : document_frequency) {
-			idf_[kv.first] = std::log(total_documents / (1.0 + static_cast<double>(kv.second))) + 1.0;
+	// bm25: mean length of the live documents
+	double average_document_length() const {
+		double total = 0.0;
+		for (size_t d = 0; d < doc_norms_.size(); ++d) {
+			if (!removed_[d]) total += doc_norms_[d];
 		}
+		return live_documents_ == 0 ? 0.0 : total / static_cast<double>(live_documents_);
 	}
 
-	void build_document_vectors() {
-		document_vectors_.clear();
-		document_vectors_.reserve(docs_tf_.size());
+	// bm25: quantized impacts from idf_ and the document lengths; at least
+	// 1, so that every posting still matches, and 0 for removed documents
+	void calculate_impacts(double average_length) {
+		const double scale = scorer_.impact_scale(idf_);
+		postings_.build_impacts([&](term t, doc_id d, float weight) -> uint16_t {
+			if (removed_[d]) return 0;
+			const double impact = scorer_.bm25(idf_[t], weight, doc_norms_[d], average_length) * scale;
+			return (uint16_t)std::clamp<long>(std::lround(impact), 1, BM25_IMPACT_MAX);
+		}, build_threads_);
+	}
 
-		for (const auto& tf : docs_tf_) {
-			weight_vector document_vector = build_document_vector(tf);
-			document_vectors_.push_back(std::move(document_vector));
+	// norms and bounds, or under bm25 lengths and impacts, from the
+	// postings once idf_ and removed_ are up to date
+	void calculate_scores_from_postings() {
+		if (scorer_.uses_impacts()) {
+			calculate_document_lengths_from_postings();
+			calculate_impacts(average_document_length());
+			return;
 		}
+		calculate_document_norms_from_postings();
+		postings_.build_bounds([this](doc_id d, float weight) { return weight / doc_norms_[d]; }, build_threads_);
 	}
 
-	weight_vector build_document_vector(const tf_map& term_frequencies) const {
-		weight_vector document_vector;
-		document_vector.reserve(term_frequencies.size());
-		double squared_norm = 0.0;
-
-		for (const auto& kv : term_frequencies) {
-			const term& term = kv.first;
-			int frequency = kv.second;
-			auto it = idf_.find(term);
-			if (it == idf_.end()) continue;
+	// what a posting's weight or impact is multiplied by for a query term
+	// of weight query_weight
+	double term_weight(term t, double query_weight) const {
+		return scorer_.uses_impacts() ? query_weight : query_weight * idf_[t];
+	}
 
-			const double term_weight = (1.0 + std::log(static_cast<double>(frequency))) * it->second;
-			document_vector.emplace(term, term_weight);
-			squared_norm += term_weight * term_weight;
-		}
+	double posting_value(const postings_cursor& c) const {
+		return scorer_.uses_impacts() ? (double)c.impact() : (double)c.weight();
+	}
 
-		if (squared_norm > 0.0) {
-			normalize_vector(document_vector, squared_norm);
-		}
+	// visit(doc, value) for every posting of t, value as in posting_value()
+	template <class visit_fn>
+	void scan_values(term t, visit_fn visit) const {
+		if (scorer_.uses_impacts()) postings_.scan_impacts(t, [&](doc_id d, uint16_t impact) { visit(d, (double)impact); });
+		else postings_.scan(t, [&](doc_id d, float weight) { visit(d, (double)weight); });
+	}
 
-		return document_vector;
+	// score of document d from its summed products; bm25 impacts are
+	// already normalized
+	double document_score(double sum, doc_id d) const {
+		return scorer_.uses_impacts() ? sum : sum / doc_norms_[d];
 	}
 
-	weight_vector build_query_vector(const std::vector<std::string>& tokens) const {
-		tf_map query_term_frequencies;
-		for (const auto& token : tokens) {
-			query_term_frequencies[token] += 1;
+	weight_vector build_query_vector(const std::vector<term>& tokens) const {
+		std::vector<term> sorted_tokens = tokens;
+		std::sort(sorted_tokens.begin(), sorted_tokens.end());
+
+		std::vector<term_count> query_term_frequencies;
+		for (term t : sorted_tokens) {
+			if (!query_term_frequencies.empty() && query_term_frequencies.back().first == t)
+				query_term_frequencies.back().second += 1;
+			else
+				query_term_frequencies.emplace_back(t, 1);
 		}
 
 		return build_and_normalize_vector(query_term_frequencies);
 	}
 
-	weight_vector build_and_normalize_vector(const tf_map& frequencies) const {
+	// under bm25 the weights are the query term counts, not normalized
+	weight_vector build_and_normalize_vector(const std::vector<term_count>& frequencies) const {
 		weight_vector vector;
+		vector.reserve(frequencies.size());
 		double squared_norm = 0.0;
 
 		for (const auto& [term, freq] : frequencies) {
-			auto it = idf_.find(term);
-			if (it == idf_.end()) continue;
+			if (term >= idf_.size() || idf_[term] == 0.0) continue;
+			if (scorer_.uses_impacts()) {
+				vector.emplace_back(term, static_cast<double>(freq));
+				continue;
+			}
 
-			double weight = (1.0 + std::log(static_cast<double>(freq))) * it->second;
-			vector[term] = weight;
+			double weight = (1.0 + std::log(static_cast<double>(freq))) * idf_[term];
+			vector.emplace_back(term, weight);
 			squared_norm += weight * weight;
 		}
 
@@ -110,85 +296,523 @@ private:
 		for (auto& kv : vector) kv.second /= norm;
 	}
 
-	double calculate_cosine_similarity(const weight_vector& query_vector, const weight_vector& document_vector) const {
-		double dot_product = 0.0;
-		for (const auto& kv : query_vector) {
-			auto it = document_vector.find(kv.first);
-			if (it != document_vector.end()) {
-				dot_product += it->second * kv.second;
+	std::vector<score_pair> exhaustive_top_k(const weight_vector& query_vector, size_t top_results_count) const {
+		if (scorer_.uses_impacts()) return impact_top_k(query_vector, top_results_count);
+		// term-at-a-time: each query term's postings are streamed once into a
+		// dense per-document accumulator
+		std::vector<double> accumulators(doc_norms_.size(), 0.0);
+		std::vector<doc_id> touched;
+		for (const auto& [t, query_weight] : query_vector) {
+			const double term_weight = query_weight * idf_[t];
+			postings_.scan(t, [&](doc_id d, float weight) {
+				double& acc = accumulators[d];
+				if (acc == 0.0) touched.push_back(d);
+				acc += term_weight * weight;
+			});
+		}
+
+		top_k_results top(top_results_count);
+		for (doc_id idx : touched) {
+			double similarity_score = accumulators[idx] / doc_norms_[idx];
+			if (similarity_score > 0.0)
+				top.push(similarity_score, idx);
+		}
+
+		return top.take();
+	}
+
+	// exhaustive_top_k() under bm25: the query term counts times the
+	// quantized impacts, summed in integers
+	std::vector<score_pair> impact_top_k(const weight_vector& query_vector, size_t top_results_count) const {
+		std::vector<uint32_t> accumulators(doc_norms_.size(), 0);
+		std::vector<doc_id> touched;
+		for (const auto& [t, query_weight] : query_vector) {
+			const uint32_t count = (uint32_t)query_weight;
+			postings_.scan_impacts(t, [&](doc_id d, uint16_t impact) {
+				uint32_t& acc = accumulators[d];
+				if (acc == 0 && impact != 0) touched.push_back(d);
+				acc += count * impact;
+			});
+		}
+
+		top_k_results top(top_results_count);
+		for (doc_id idx : touched) top.push((double)accumulators[idx], idx);
+		return top.take();
+	}
+
+	// Document-at-a-time WAND: cursors are kept ordered by their current
+	// document, and the first document (the pivot) whose summed term upper
+	// bounds can beat the current top-k threshold is the next one scored;
+	// cursors before it jump straight to it. With block_max the pivot is
+	// also checked against the bounds of the blocks that contain it, and
+	// whole block ranges that cannot qualify are skipped.
+	std::vector<score_pair> wand_top_k(const weight_vector& query_vector, size_t top_results_count, bool block_max) const {
+		struct term_cursor {
+			postings_cursor postings;
+			double term_weight;
+			double upper_bound;
+		};
+
+		if (top_results_count == 0) return {};
+
+		std::vector<term_cursor> cursors;
+		for (const auto& [t, query_weight] : query_vector) {
+			const double weight = term_weight(t, query_weight);
+			cursors.push_back({ postings_.cursor(t), weight, weight * postings_.max_impact(t) });
+		}
+
+		std::vector<size_t> order(cursors.size());
+		for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+		top_k_results top(top_results_count);
+		while (true) {
+			// only a few cursors move per round, insertion sort restores the order cheaply
+			for (size_t i = 1; i < order.size(); ++i) {
+				size_t moved = order[i];
+				doc_id d = cursors[moved].postings.doc();
+				size_t j = i;
+				for (; j > 0 && cursors[order[j - 1]].postings.doc() > d; --j) order[j] = order[j - 1];
+				order[j] = moved;
+			}
+
+			const double threshold = top.full() ? top.threshold() : 0.0;
+			double bound = 0.0;
+			size_t pivot = order.size();
+			for (size_t i = 0; i < order.size(); ++i) {
+				if (cursors[order[i]].postings.doc() == postings_cursor::END) break;
+				bound += cursors[order[i]].upper_bound;
+				if (bound * (1.0 + BOUND_SLACK) >= threshold) {
+					pivot = i;
+					break;
+				}
+			}
+			if (pivot == order.size()) break;
+
+			const doc_id pivot_doc = cursors[order[pivot]].postings.doc();
+			// cursors tied with the pivot contribute to it as well
+			while (pivot + 1 < order.size() && cursors[order[pivot + 1]].postings.doc() == pivot_doc) ++pivot;
+
+			if (block_max) {
+				double block_bound = 0.0;
+				doc_id next_boundary = postings_cursor::END;
+				for (size_t i = 0; i <= pivot; ++i) {
+					auto& c = cursors[order[i]];
+					c.postings.shallow_advance(pivot_doc);
+					block_bound += c.term_weight * c.postings.block_max();
+					next_boundary = std::min(next_boundary, c.postings.block_last());
+				}
+
+				if (block_bound * (1.0 + BOUND_SLACK) < threshold) {
+					// nothing before the nearest block end, or before the first
+					// cursor not taking part, can make it into the top-k
+					doc_id skip_to = next_boundary == postings_cursor::END ? postings_cursor::END : next_boundary + 1;
+					if (pivot + 1 < order.size())
+						skip_to = std::min(skip_to, cursors[order[pivot + 1]].postings.doc());
+					skip_to = std::max(skip_to, (doc_id)(pivot_doc + 1));
+					for (size_t i = 0; i <= pivot; ++i) cursors[order[i]].postings.advance(skip_to);
+					continue;
+				}
+			}
+
+			if (cursors[order[0]].postings.doc() == pivot_doc) {
+				// summed in query term order, exactly like exhaustive_top_k
+				double dot_product = 0.0;
+				for (auto& c : cursors) {
+					if (c.postings.doc() == pivot_doc) {
+						dot_product += c.term_weight * posting_value(c.postings);
+						c.postings.next();
+					}
+				}
+				double similarity_score = document_score(dot_product, pivot_doc);
+				if (similarity_score > 0.0)
+					top.push(similarity_score, pivot_doc);
+			}
+			else {
+				for (size_t i = 0; i < pivot; ++i) {
+					auto& c = cursors[order[i]].postings;
+					if (c.doc() < pivot_doc) c.advance(pivot_doc);
+				}
 			}
 		}
-		return dot_product;
+
+		return top.take();
 	}
 
-	std::vector<score_pair> get_top_results(std::vector<score_pair>& scores, size_t top_results_count) const {
-		if (scores.empty()) return {};
+	// Documents containing every required term, each with its plain
+	// score, best first. The positional pass only looks at these.
+	std::vector<score_pair> conjunctive_candidates(const weight_vector& query_vector, const std::vector<term>& required) const {
+		std::vector<double> accumulators(doc_norms_.size(), 0.0);
+		std::vector<uint32_t> matched(doc_norms_.size(), 0);
+		std::vector<doc_id> touched;
+		for (const auto& [t, query_weight] : query_vector) {
+			const double weight = term_weight(t, query_weight);
+			const bool is_required = std::binary_search(required.begin(), required.end(), t);
+			scan_values(t, [&](doc_id d, double value) {
+				double& acc = accumulators[d];
+				if (acc == 0.0) touched.push_back(d);
+				acc += weight * value;
+				if (is_required) matched[d] += 1;
+			});
+		}
 
-		if (top_results_count >= scores.size()) {
-			std::sort(scores.begin(), scores.end(),
-				[](const score_pair& a, const score_pair& b) { return a.first > b.first; });
-			return scores;
+		std::vector<score_pair> candidates;
+		for (doc_id idx : touched) {
+			double similarity_score = document_score(accumulators[idx], idx);
+			if (matched[idx] == required.size() && similarity_score > 0.0)
+				candidates.emplace_back(similarity_score, idx);
 		}
+		std::sort(candidates.begin(), candidates.end(), ranks_before);
+		return candidates;
+	}
 
-		std::partial_sort(scores.begin(), scores.begin() + top_results_count, scores.end(),
-			[](const score_pair& a, const score_pair& b) { return a.first > b.first; });
+	// true if some position p has phrase[j] at p + j for every j;
+	// positions_of(t) gives the positions of t in the document
+	template <class positions_of_fn>
+	static bool contains_phrase(const std::vector<term>& phrase, positions_of_fn positions_of) {
+		const std::vector<uint32_t>& starts = positions_of(phrase[0]);
+		for (uint32_t p : starts) {
+			size_t j = 1;
+			for (; j < phrase.size(); ++j) {
+				const std::vector<uint32_t>& next = positions_of(phrase[j]);
+				if (!std::binary_search(next.begin(), next.end(), p + (uint32_t)j)) break;
+			}
+			if (j == phrase.size()) return true;
+		}
+		return false;
+	}
 
-		return std::vector<score_pair>(scores.begin(), scores.begin() + top_results_count);
+	// Mean over neighbouring query terms (in query order) of 1 / the
+	// smallest distance between their occurrences; a pair that does not
+	// co-occur counts as 0. 1 when every neighbouring pair appears adjacent.
+	template <class positions_of_fn>
+	static double proximity(const std::vector<term>& tokens, positions_of_fn positions_of) {
+		double sum = 0.0;
+		size_t pairs = 0;
+		for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+			if (tokens[i] == tokens[i + 1]) continue;
+			++pairs;
+			const std::vector<uint32_t>& a = positions_of(tokens[i]);
+			const std::vector<uint32_t>& b = positions_of(tokens[i + 1]);
+			uint32_t closest = UINT32_MAX;
+			for (size_t x = 0, y = 0; x < a.size() && y < b.size();) {
+				closest = std::min(closest, a[x] < b[y] ? b[y] - a[x] : a[x] - b[y]);
+				if (a[x] < b[y]) ++x;
+				else ++y;
+			}
+			if (closest != UINT32_MAX) sum += 1.0 / closest;
+		}
+		return pairs == 0 ? 0.0 : sum / pairs;
 	}
+
 public:
-	void build(doc_list& docs) {
+	// takes effect on the next build()
+	void set_postings_codec(postings_codec codec) { postings_.set_codec(codec); }
+
+	// takes effect on the next build(); a loaded index has to have been
+	// built with the same scorer
+	void set_scorer(const scorer& scoring) { scorer_ = scoring; }
+
+	const scorer& get_scorer() const { return scorer_; }
+
+	// keep token positions in the postings, for phrase queries and
+	// proximity scoring; takes effect on the next build()
+	void set_positions(bool positions) { store_positions_ = positions; }
+
+	bool stores_positions() const { return store_positions_; }
+
+	// true if the built or loaded index has positions
+	bool has_positions() const { return postings_.has_positions(); }
+
+	// worker threads used by build(); the index does not depend on it
+	void set_build_threads(size_t threads) { build_threads_ = std::max<size_t>(1, threads); }
+
+	void build(doc_list& docs, const term_dictionary& dictionary) {
 		docs_tf_.clear();
-		inverted_index_.clear();
+		idf_.reset().assign(dictionary.size(), 0.0);
+		removed_.reset().assign(docs.size(), 0);
+		live_documents_ = docs.size();
+		added_.clear();
+		updates_pending_ = false;
 
 		for (size_t doc_id = 0; doc_id < docs.size(); ++doc_id) {
-			const auto _content = docs[doc_id]->get_content();
-			auto tf = _content->get_tf_map();
-			docs_tf_.push_back(tf);
-			for (const auto& kv : tf) {
-				inverted_index_[kv.first].push_back(doc_id);
-			}
+			docs_tf_.push_back(&docs[doc_id]->get_terms());
 		}
 
 		if (docs_tf_.empty()) {
-			idf_.clear();
-			document_vectors_.clear();
+			postings_.clear();
+			doc_norms_.clear();
+			df_.clear();
 			return;
 		}
 
+		postings_.build(docs_tf_, dictionary.size(), [this](uint32_t frequency) { return tf_weight(frequency); }, build_threads_);
+		df_.resize(dictionary.size());
+		for (size_t t = 0; t < df_.size(); ++t) df_[t] = (uint32_t)postings_.size((term)t);
 		calculate_idf();
-		build_document_vectors();
+		if (scorer_.uses_impacts()) calculate_scores_from_postings();
+		else {
+			calculate_document_norms();
+			postings_.build_bounds([this](doc_id d, float weight) { return weight / doc_norms_[d]; }, build_threads_);
+		}
+		if (store_positions_) {
+			postings_.build_positions(docs_tf_, [&docs](doc_id d, size_t i) { return docs[d]->get_positions(i); }, build_threads_);
+		}
+		docs_tf_.clear();
+	}
+
+	std::vector<score_pair> rank_tokens(const std::vector<term>& tokens, size_t top_results_count = 10,
+		retrieval_mode mode = retrieval_mode::exhaustive) const {
+		if (tokens.empty() || doc_norms_.empty()) return {};
+
+		weight_vector query_vector = build_query_vector(tokens);
+		if (query_vector.empty()) return {};
 
-		for (auto& kv : inverted_index_) {
-			auto& v = kv.second;
-			std::sort(v.begin(), v.end());
-			v.erase(std::unique(v.begin(), v.end()), v.end());
+		if (mode == retrieval_mode::exhaustive) {
+			return exhaustive_top_k(query_vector, top_results_count);
 		}
+		return wand_top_k(query_vector, top_results_count, mode == retrieval_mode::block_max_wand);
 	}
 
-	std::vector<score_pair> rank_tokens(const std::vector<std::string>& tokens, size_t top_results_count = 10) const {
-		if (tokens.empty() || document_vectors_.empty()) return {};
+	// Ranks like rank_tokens() and then, if the index has positions, keeps
+	// only documents containing every phrase (runs of consecutive query
+	// terms) and boosts documents whose query terms sit close together.
+	// Positions are decoded only for candidates of the non-positional
+	// pass: the documents holding every phrase term, or the top
+	// PROXIMITY_RERANK * k of a plain query. Candidates are visited best
+	// first and the visit stops once no boost can lift the next one into
+	// the top-k. Without positions phrases are treated as plain terms.
+	std::vector<score_pair> rank_query(const std::vector<term>& tokens, const std::vector<std::vector<term>>& phrases,
+		size_t top_results_count = 10, retrieval_mode mode = retrieval_mode::exhaustive) const {
+		if (!has_positions()) return rank_tokens(tokens, top_results_count, mode);
+		if (tokens.empty() || doc_norms_.empty() || top_results_count == 0) return {};
 
 		weight_vector query_vector = build_query_vector(tokens);
 		if (query_vector.empty()) return {};
 
-		std::unordered_set<size_t> candidates;
-		for (const auto& t : tokens) {
-			auto it = inverted_index_.find(t);
-			if (it != inverted_index_.end()) {
-				candidates.insert(it->second.begin(), it->second.end());
+		std::vector<term> required;
+		for (const auto& phrase : phrases) {
+			for (term t : phrase) {
+				// a phrase term that is in no document matches nothing
+				if (t >= idf_.size() || idf_[t] == 0.0) return {};
+				required.push_back(t);
 			}
 		}
+		std::sort(required.begin(), required.end());
+		required.erase(std::unique(required.begin(), required.end()), required.end());
+		if (required.empty() && query_vector.size() < 2) return rank_tokens(tokens, top_results_count, mode);
+
+		std::vector<score_pair> candidates;
+		if (!required.empty()) candidates = conjunctive_candidates(query_vector, required);
+		else if (mode == retrieval_mode::exhaustive) candidates = exhaustive_top_k(query_vector, PROXIMITY_RERANK * top_results_count);
+		else candidates = wand_top_k(query_vector, PROXIMITY_RERANK * top_results_count, mode == retrieval_mode::block_max_wand);
+
+		// positions of the query terms in the current candidate, decoded on first use
+		std::vector<term> distinct;
+		for (const auto& kv : query_vector) distinct.push_back(kv.first);
+		std::vector<std::vector<uint32_t>> positions(distinct.size());
+		std::vector<bool> decoded(distinct.size());
+		doc_id current = 0;
+		auto positions_of = [&](term t) -> const std::vector<uint32_t>& {
+			static const std::vector<uint32_t> none;
+			const size_t i = std::lower_bound(distinct.begin(), distinct.end(), t) - distinct.begin();
+			if (i == distinct.size() || distinct[i] != t) return none;
+			if (!decoded[i]) {
+				postings_.positions(t, current, positions[i]);
+				decoded[i] = true;
+			}
+			return positions[i];
+		};
+
+		top_k_results top(top_results_count);
+		for (const auto& [score, d] : candidates) {
+			if (top.full() && score * (1.0 + PROXIMITY_WEIGHT) * (1.0 + BOUND_SLACK) < top.threshold()) break;
+			current = (doc_id)d;
+			std::fill(decoded.begin(), decoded.end(), false);
+			bool matches = true;
+			for (const auto& phrase : phrases) {
+				if (!phrase.empty() && !contains_phrase(phrase, positions_of)) {
+					matches = false;
+					break;
+				}
+			}
+			if (!matches) continue;
+			top.push(score * (1.0 + PROXIMITY_WEIGHT * proximity(tokens, positions_of)), d);
+		}
+		return top.take();
+	}
 
-		if (candidates.empty()) return {};
+	// Appends doc as the next document id (document_count() before the
+	// call), which is returned. doc must stay alive until apply_updates().
+	// Document frequencies change at once, everything else is deferred.
+	doc_id add_document(const doc_t& doc) {
+		const doc_id d = (doc_id)removed_.size();
+		removed_.edit().push_back(0);
+		live_documents_ += 1;
+		for (const auto& kv : doc.get_terms()) {
+			if (kv.first >= df_.size()) df_.resize(kv.first + 1, 0);
+			df_[kv.first] += 1;
+		}
+		added_.push_back(&doc);
+		updates_pending_ = true;
+		return d;
+	}
 
-		std::vector<score_pair> document_scores;
-		document_scores.reserve(candidates.size());
-		for (size_t idx : candidates) {
-			double similarity_score = calculate_cosine_similarity(query_vector, document_vectors_[idx]);
-			if (similarity_score > 0.0)
-				document_scores.emplace_back(similarity_score, idx);
+	// Drops document d, whose terms are given as (term id, frequency); the
+	// id is not reused. Takes effect in apply_updates() like add_document().
+	void remove_document(doc_id d, const std::vector<term_count>& terms) {
+		if (d >= removed_.size() || removed_[d]) return;
+		removed_.edit()[d] = 1;
+		live_documents_ -= 1;
+		for (const auto& kv : terms) {
+			if (kv.first < df_.size() && df_[kv.first] != 0) df_[kv.first] -= 1;
 		}
+		updates_pending_ = true;
+	}
+
+	bool has_pending_updates() const { return updates_pending_; }
+
+	// Brings the index up to date with the adds and removes so far: the
+	// postings are rewritten once for the whole batch, then idf, norms and
+	// bounds are recomputed from them. Run it before querying; it is much
+	// cheaper than build() as no document is read or tokenized again.
+	void apply_updates(const term_dictionary& dictionary) { apply_updates(dictionary.size()); }
+
+	// same, for a vocabulary of at least the given number of terms
+	void apply_updates(size_t vocabulary_size) {
+		if (!updates_pending_) return;
+		const size_t vocabulary = std::max(vocabulary_size, df_.size());
+		df_.resize(vocabulary, 0);
+
+		std::vector<const std::vector<term_count>*> added_terms;
+		for (const doc_t* doc : added_) added_terms.push_back(&doc->get_terms());
+		const doc_id first = (doc_id)(removed_.size() - added_.size());
+		postings_.update(added_terms, first, vocabulary,
+			[this](doc_id d) { return removed_[d] != 0; }, [this](uint32_t frequency) { return tf_weight(frequency); },
+			store_positions_ || postings_.has_positions(),
+			[this](size_t i, size_t j) { return added_[i]->get_positions(j); }, build_threads_);
+
+		auto& idf = idf_.edit();
+		idf.resize(vocabulary, 0.0);
+		calculate_idf();
+		calculate_scores_from_postings();
+
+		added_.clear();
+		updates_pending_ = false;
+	}
+
+	// Makes this ranker the concatenation of parts, document d of parts[i]
+	// becoming bases[i] + d; bases must leave no gaps and documents of
+	// this many. Postings of documents for which removed(d) holds are
+	// dropped while their ids stay, as in apply_updates(); with renumber
+	// their ids go as well, the others being numbered from 0 in order.
+	// The parts need no pending updates.
+	template <class removed_fn>
+	void merge(const std::vector<const search_ranker*>& parts, const std::vector<doc_id>& bases, size_t documents,
+		size_t vocabulary_size, removed_fn removed, bool renumber = false) {
+		std::vector<const postings_index*> part_postings;
+		for (const search_ranker* part : parts) part_postings.push_back(&part->postings_);
+		docs_tf_.clear();
+		added_.clear();
+		updates_pending_ = false;
+		auto& removed_flags = removed_.reset();
+		std::vector<doc_id> renumbered;
+		if (renumber) {
+			renumbered.resize(documents);
+			doc_id kept = 0;
+			for (size_t d = 0; d < documents; ++d) {
+				renumbered[d] = kept;
+				if (!removed((doc_id)d)) ++kept;
+			}
+			removed_flags.assign(kept, 0);
+		}
+		else {
+			removed_flags.resize(documents);
+			for (size_t d = 0; d < documents; ++d) removed_flags[d] = removed((doc_id)d) ? 1 : 0;
+		}
+		live_documents_ = (size_t)std::count(removed_flags.begin(), removed_flags.end(), 0);
+
+		postings_.merge(part_postings, bases, vocabulary_size, removed, build_threads_, renumber ? &renumbered : nullptr);
+		df_.assign(vocabulary_size, 0);
+		for (size_t t = 0; t < df_.size(); ++t) df_[t] = (uint32_t)postings_.size((term)t);
+		idf_.reset().assign(vocabulary_size, 0.0);
+		calculate_idf();
+		calculate_scores_from_postings();
+	}
+
+	// Scores the documents with the given idf, terms long, and under bm25
+	// the given average document length, instead of the ranker's own, as a
+	// part of a larger collection does. removed(d) hides document d: its
+	// postings stay but it gets an infinite norm, or zero impacts, so it
+	// scores 0 everywhere. Norms or impacts and the bounds are recomputed;
+	// idf is viewed and must outlive the ranker's use.
+	template <class removed_fn>
+	void rescore(const double* idf, size_t terms, removed_fn removed, double average_length) {
+		idf_.view(idf, terms);
+		auto& removed_flags = removed_.reset();
+		removed_flags.resize(doc_norms_.size());
+		for (size_t d = 0; d < removed_flags.size(); ++d) removed_flags[d] = removed((doc_id)d) ? 1 : 0;
+		live_documents_ = (size_t)std::count(removed_flags.begin(), removed_flags.end(), 0);
+
+		if (scorer_.uses_impacts()) {
+			calculate_document_lengths_from_postings();
+			calculate_impacts(average_length);
+			return;
+		}
+
+		calculate_document_norms_from_postings();
+		auto& doc_norms = doc_norms_.edit();
+		for (size_t d = 0; d < doc_norms.size(); ++d) {
+			if (removed_flags[d]) doc_norms[d] = INFINITY;
+		}
+		postings_.build_bounds([this](doc_id d, float weight) { return weight / doc_norms_[d]; }, build_threads_);
+	}
+
+	// Views scores saved apart from the ranker, as left by rescore(): idf
+	// of terms >= the vocabulary, norms and removed flags of every
+	// document, the bounds of postings().block_maxima() and max_impacts()
+	// and the postings().impacts() of a bm25 ranker. False if they do not
+	// fit the loaded postings.
+	bool view_scores(const double* idf, size_t terms, const double* norms, const uint8_t* removed, size_t documents,
+		const float* block_max, size_t blocks, const float* max_impact, size_t impact_terms, const uint16_t* impacts, size_t postings) {
+		if (terms < postings_.vocabulary_size() || documents != removed_.size() ||
+			!postings_.view_bounds(block_max, blocks, max_impact, impact_terms) || !postings_.view_impacts(impacts, postings)) return false;
+		idf_.view(idf, terms);
+		doc_norms_.view(norms, documents);
+		removed_.view(removed, documents);
+		live_documents_ = (size_t)std::count(removed_.begin(), removed_.end(), 0);
+		return true;
+	}
+
+	const postings_index& postings() const { return postings_; }
+
+	const stored_vector<double>& document_norms() const { return doc_norms_; }
 
-		return get_top_results(document_scores, top_results_count);
+	bool is_removed(doc_id d) const { return d < removed_.size() && removed_[d] != 0; }
+
+	size_t live_document_count() const { return live_documents_; }
+
+	size_t document_frequency(term t) const { return t < df_.size() ? df_[t] : 0; }
+
+	// every document id handed out, removed ones included
+	size_t document_count() const { return removed_.size(); }
+
+	void save(index_file_writer& out) const {
+		out.add(section_tag("RIDF"), idf_);
+		out.add(section_tag("RNRM"), doc_norms_);
+		out.add(section_tag("RDEL"), removed_);
+		postings_.save(out);
+	}
+
+	bool load(const mapped_index_file& in) {
+		docs_tf_.clear();
+		added_.clear();
+		updates_pending_ = false;
+		if (!in.view(section_tag("RIDF"), idf_) || !in.view(section_tag("RNRM"), doc_norms_) ||
+			!in.view(section_tag("RDEL"), removed_) || !postings_.load(in)) return false;
+		if (idf_.size() != postings_.vocabulary_size() || doc_norms_.empty() || removed_.size() != doc_norms_.size()) return false;
+		df_.resize(postings_.vocabulary_size());
+		for (size_t t = 0; t < df_.size(); ++t) df_[t] = (uint32_t)postings_.size((term)t);
+		live_documents_ = (size_t)std::count(removed_.begin(), removed_.end(), 0);
+		return true;
 	}
 };
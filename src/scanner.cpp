@@ -0,0 +1,130 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCANNER_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline size_t trailing_zeros(uint64_t x) { unsigned long i; _BitScanForward64(&i, x); return i; }
+#else
+static inline size_t trailing_zeros(uint64_t x) { return (size_t)__builtin_ctzll(x); }
+#endif
+
+// Token character scanners. A scanner looks at up to SCAN_CHUNK bytes,
+// writes them lower-cased to out and returns a mask with bit i set when
+// byte i is a token character. Token characters are the ASCII letters and
+// digits, which is what std::isalpha / std::isdigit accept in the "C"
+// locale the engine runs in; only letters are lower-cased.
+#define SCAN_CHUNK 32
+
+using scan_fn = uint32_t (*)(const char* in, size_t n, char* out);
+
+static uint32_t scan_scalar(const char* in, size_t n, char* out) {
+	uint32_t mask = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const unsigned char ch = (unsigned char)in[i];
+		const unsigned char lower = ch | 0x20;
+		const bool letter = lower >= 'a' && lower <= 'z';
+		const bool digit = ch >= '0' && ch <= '9';
+		out[i] = letter ? (char)lower : (char)ch;
+		mask |= (uint32_t)(letter || digit) << i;
+	}
+	return mask;
+}
+
+#ifdef SCANNER_X86
+// Bytes are compared as signed, so everything from 0x80 up is negative and
+// falls outside both ranges.
+static uint32_t scan_sse2(const char* in, size_t n, char* out) {
+	if (n < SCAN_CHUNK) return scan_scalar(in, n, out);
+
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	uint32_t mask = 0;
+	for (size_t half = 0; half < 2; ++half) {
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * half));
+		const __m128i folded = _mm_or_si128(x, case_bit);
+		const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+		const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * half), _mm_or_si128(x, _mm_and_si128(letter, case_bit)));
+		mask |= (uint32_t)_mm_movemask_epi8(_mm_or_si128(letter, digit)) << (16 * half);
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint32_t scan_avx2(const char* in, size_t n, char* out) {
+	if (n < SCAN_CHUNK) return scan_scalar(in, n, out);
+
+	const __m256i case_bit = _mm256_set1_epi8(0x20);
+	const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+	const __m256i folded = _mm256_or_si256(x, case_bit);
+	const __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(folded, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), folded));
+	const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_or_si256(x, _mm256_and_si256(letter, case_bit)));
+	return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(letter, digit));
+}
+#endif
+
+struct named_scanner {
+	const char* name;
+	scan_fn scan;
+};
+
+// every scanner this CPU can run, the fastest last
+static std::vector<named_scanner> available_scanners() {
+	std::vector<named_scanner> scanners = { { "scalar", scan_scalar } };
+#ifdef SCANNER_X86
+	scanners.push_back({ "sse2", scan_sse2 });
+	if (__builtin_cpu_supports("avx2")) scanners.push_back({ "avx2", scan_avx2 });
+#endif
+	return scanners;
+}
+
+// picked once, on first use
+static scan_fn best_scanner() {
+	static const scan_fn best = available_scanners().back().scan;
+	return best;
+}
+
+// Splits text into maximal runs of token characters. Each token is
+// lower-cased into scratch, which always keeps at least one spare byte
+// past the token, and passed to sink(char* token, size_t length,
+// size_t offset) while it sits there, offset being where the token starts
+// in text; sink may modify it in place.
+template <class sink_fn>
+void for_each_token(const char* text, size_t length, scan_fn scan, std::string& scratch, sink_fn sink) {
+	char lowered[SCAN_CHUNK];
+	size_t n = 0, start = 0;
+	for (size_t base = 0; base < length; base += SCAN_CHUNK) {
+		const size_t chunk = length - base < SCAN_CHUNK ? length - base : SCAN_CHUNK;
+		const uint64_t mask = scan(text + base, chunk, lowered);
+		size_t i = 0;
+		while (i < chunk) {
+			const uint64_t rest = mask >> i;
+			if (rest & 1) {
+				// run of token characters, possibly continuing into the next chunk
+				size_t run = trailing_zeros(~rest);
+				if (run > chunk - i) run = chunk - i;
+				if (n == 0) start = base + i;
+				if (n + run + 1 > scratch.size()) scratch.resize(2 * (n + run + 1));
+				std::memcpy(&scratch[n], lowered + i, run);
+				n += run;
+				i += run;
+			}
+			else {
+				if (n != 0) {
+					sink(&scratch[0], n, start);
+					n = 0;
+				}
+				i = rest == 0 ? chunk : i + trailing_zeros(rest);
+			}
+		}
+	}
+	if (n != 0) sink(&scratch[0], n, start);
+}
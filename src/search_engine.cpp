@@ -2,7 +2,12 @@
 #include <fstream>
 #include <filesystem>
 #include <unordered_set>
-#include "ranker.cpp"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "discovery.cpp"
 
 #define TIME_TESTS
 #include <chrono>
@@ -12,148 +17,768 @@
 
 namespace fs = std::filesystem;
 
-static std::string read_file(const fs::path& p) {
-	std::ifstream in(p, std::ios::binary);
-	if (!in) {
-		std::cerr << "Warning: cannot open file: " << p.string() << "\n";
-		return {};
+// Exact-match automaton over the stems of one query, built once per query
+// and shared by all of its snippets. A stem is walked through a flat
+// transition table a byte at a time, so testing a token costs its length
+// whatever the number of query terms. Stems are whole tokens, so unlike
+// Aho-Corasick no failure links are needed.
+class stem_matcher {
+private:
+	// stems only hold lower-case letters, see porter::keep_only_letters()
+	static constexpr size_t ALPHABET = 26;
+	static constexpr int32_t NONE = -1;
+
+	// transitions of state s at next_[s * ALPHABET .. (s + 1) * ALPHABET]
+	std::vector<int32_t> next_;
+	std::vector<bool> accept_;
+
+	static int symbol(char ch) {
+		if (ch >= 'a' && ch <= 'z') return ch - 'a';
+		return NONE;
 	}
-	std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
-	return s;
-}
 
+	int32_t add_state() {
+		next_.resize(next_.size() + ALPHABET, NONE);
+		accept_.push_back(false);
+		return (int32_t)accept_.size() - 1;
+	}
+public:
+	explicit stem_matcher(const std::vector<std::string>& stems) {
+		add_state();
+		for (const auto& stem : stems) {
+			int32_t state = 0;
+			bool valid = true;
+			for (char ch : stem) {
+				const int c = symbol(ch);
+				if (c == NONE) {
+					valid = false;
+					break;
+				}
+				if (next_[state * ALPHABET + c] == NONE) {
+					const int32_t added = add_state();
+					next_[state * ALPHABET + c] = added;
+				}
+				state = next_[state * ALPHABET + c];
+			}
+			if (valid) accept_[state] = true;
+		}
+	}
+
+	bool matches(std::string_view stem) const {
+		int32_t state = 0;
+		for (char ch : stem) {
+			const int c = symbol(ch);
+			if (c == NONE) return false;
+			state = next_[state * ALPHABET + c];
+			if (state == NONE) return false;
+		}
+		return accept_[state];
+	}
+};
+
+// Snippets are cut from the document store: the window is anchored at the
+// first occurrence of a query term and only the window itself is
+// tokenized again, to bracket the tokens the query's stem_matcher accepts.
+// Text and brackets are appended to one output buffer in a single pass.
 class SnippetGenerator {
 private:
-	static std::string to_lower_case(const std::string& str) {
-		std::string result = str;
-		std::transform(result.begin(), result.end(), result.begin(),
-			[](unsigned char c) { return std::tolower(c); });
-		return result;
+	static bool is_token_char(char ch) {
+		return std::isalpha((unsigned char)ch) || std::isdigit((unsigned char)ch);
 	}
 
-	static size_t find_first_match(const std::string& text_lower,
-		const std::unordered_set<std::string>& terms) {
-		size_t best_position = std::string::npos;
+	static void highlight_terms(std::string_view snippet, const stem_matcher& matcher, std::string& out) {
+		size_t copied = 0;
+		for_each_term(snippet.data(), snippet.size(), [&](std::string_view stem, size_t offset) {
+			if (!matcher.matches(stem)) return;
+			size_t end = offset;
+			while (end < snippet.size() && is_token_char(snippet[end])) ++end;
+			out.append(snippet.data() + copied, offset - copied);
+			out += '[';
+			out.append(snippet.data() + offset, end - offset);
+			out += ']';
+			copied = end;
+		});
+		out.append(snippet.data() + copied, snippet.size() - copied);
+	}
 
-		for (const auto& term : terms) {
-			if (term.empty()) continue;
+	static std::string truncate_text(std::string_view text, size_t max_length) {
+		if (text.length() <= max_length) {
+			return std::string(text);
+		}
+		return std::string(text.substr(0, max_length)) + "...";
+	}
+public:
+	static constexpr size_t CONTEXT_BEFORE = 40;
+	static constexpr size_t CONTEXT_AFTER = 120;
+	static constexpr size_t MAX_SNIPPET_LEN = CONTEXT_BEFORE + CONTEXT_AFTER;
 
-			size_t position = text_lower.find(term);
-			if (position != std::string::npos) {
-				if (best_position == std::string::npos || position < best_position) {
-					best_position = position;
-				}
+	// matcher accepts the query's stems, query_terms are their ids in the
+	// dictionary
+	static std::string make_snippet(const document_store& store, size_t doc,
+		const stem_matcher& matcher, const std::vector<term_id>& query_terms) {
+		const std::string_view text = store.text(doc);
+		const size_t match_position = store.first_occurrence(doc, query_terms);
+		if (text.empty() || match_position >= text.length()) {
+			return truncate_text(text, MAX_SNIPPET_LEN);
+		}
+
+		size_t start = (match_position > CONTEXT_BEFORE) ?
+			match_position - CONTEXT_BEFORE : 0;
+		// do not start inside a word, its tail could stem to a query term
+		while (start > 0 && start < match_position && is_token_char(text[start - 1])) ++start;
+		size_t end = std::min(match_position + CONTEXT_AFTER, text.length());
+
+		std::string highlighted;
+		highlighted.reserve(end - start + 32);
+		if (start > 0) highlighted += "...";
+		highlight_terms(text.substr(start, end - start), matcher, highlighted);
+		if (end < text.length()) highlighted += "...";
+		return highlighted;
+	}
+};
+
+struct engine_options {
+	retrieval_mode mode = retrieval_mode::exhaustive;
+	postings_codec codec = postings_codec::raw;
+	// scoring model and its parameters
+	scorer scoring;
+	bool bench = false;
+	// index file, <folder>/.search_index when empty
+	std::string index_path;
+	bool rebuild = false;
+	// token positions in the postings, for phrase queries and proximity
+	bool positions = false;
+	// ingestion workers
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	// keep the index in line with the folder while taking queries
+	bool watch = false;
+	// which files under the folder are indexed, *.txt by default
+	path_filter filter;
+};
+
+static bool parse_options(int argc, char* argv[], engine_options& options) {
+	bool included = false;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--bench") {
+			options.bench = true;
+		}
+		else if (arg == "--mode" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "exhaustive") options.mode = retrieval_mode::exhaustive;
+			else if (mode == "wand") options.mode = retrieval_mode::wand;
+			else if (mode == "bmw") options.mode = retrieval_mode::block_max_wand;
+			else {
+				std::cerr << "Unknown retrieval mode: " << mode << " (exhaustive, wand, bmw)\n";
+				return false;
+			}
+		}
+		else if (arg == "--codec" && i + 1 < argc) {
+			std::string codec = argv[++i];
+			if (codec == "raw") options.codec = postings_codec::raw;
+			else if (codec == "varint") options.codec = postings_codec::varint;
+			else if (codec == "pfor") options.codec = postings_codec::pfor;
+			else {
+				std::cerr << "Unknown postings codec: " << codec << " (raw, varint, pfor)\n";
+				return false;
+			}
+		}
+		else if (arg == "--scoring" && i + 1 < argc) {
+			std::string model = argv[++i];
+			if (model == "cosine") options.scoring.model = scoring_model::cosine;
+			else if (model == "bm25") options.scoring.model = scoring_model::bm25;
+			else {
+				std::cerr << "Unknown scoring model: " << model << " (cosine, bm25)\n";
+				return false;
 			}
 		}
+		else if (arg == "--k1" && i + 1 < argc) {
+			try { options.scoring.k1 = std::stod(argv[++i]); }
+			catch (...) { options.scoring.k1 = -1.0; }
+			if (!(options.scoring.k1 >= 0.0)) {
+				std::cerr << "Invalid k1: " << argv[i] << "\n";
+				return false;
+			}
+		}
+		else if (arg == "--b" && i + 1 < argc) {
+			try { options.scoring.b = std::stod(argv[++i]); }
+			catch (...) { options.scoring.b = -1.0; }
+			if (!(options.scoring.b >= 0.0 && options.scoring.b <= 1.0)) {
+				std::cerr << "Invalid b: " << argv[i] << " (0 to 1)\n";
+				return false;
+			}
+		}
+		else if (arg == "--index" && i + 1 < argc) {
+			options.index_path = argv[++i];
+		}
+		else if (arg == "--rebuild") {
+			options.rebuild = true;
+		}
+		else if (arg == "--positions") {
+			options.positions = true;
+		}
+		else if (arg == "--watch") {
+			options.watch = true;
+		}
+		else if (arg == "--include" && i + 1 < argc) {
+			// the first --include replaces the default
+			if (!included) options.filter.include.clear();
+			included = true;
+			options.filter.include.push_back(argv[++i]);
+		}
+		else if (arg == "--exclude" && i + 1 < argc) {
+			options.filter.exclude.push_back(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			try { options.threads = std::stoul(argv[++i]); }
+			catch (...) { options.threads = 0; }
+			if (options.threads == 0) {
+				std::cerr << "Invalid thread count: " << argv[i] << "\n";
+				return false;
+			}
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--mode exhaustive|wand|bmw] [--codec raw|varint|pfor] [--scoring cosine|bm25] [--k1 X] [--b X] [--index FILE] [--rebuild] [--positions] [--threads N] [--watch] [--include GLOB]... [--exclude GLOB]... [--bench]\n";
+			return false;
+		}
+	}
+	return true;
+}
 
-		return best_position;
+// Identifies the settings an index file was built with: the codec, the
+// scoring model with its parameters and whether positions are kept. Which
+// files it holds is checked per file, see sync_index().
+static uint64_t index_fingerprint(postings_codec codec, const scorer& scoring, bool positions) {
+	uint64_t h = INDEX_CHECKSUM_SEED;
+	auto mix = [&h](const void* data, size_t bytes) {
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < bytes; ++i) h = (h ^ p[i]) * 0x100000001b3ull;
+	};
+	const uint32_t c = (uint32_t)codec;
+	mix(&c, sizeof(c));
+	if (scoring.model == scoring_model::bm25) {
+		mix("BM25", 4);
+		mix(&scoring.k1, sizeof(scoring.k1));
+		mix(&scoring.b, sizeof(scoring.b));
 	}
+	if (positions) mix("POS", 3);
+	return h;
+}
 
-	static std::string extract_context_with_highlight(
-		const std::string& original_text,
-		const std::string& text_lower,
-		size_t match_position,
-		const std::unordered_set<std::string>& terms) {
+// Size, modification time and content hash of a file when it was indexed.
+// A file whose size and time still match is taken as unchanged without
+// reading it; otherwise it is only indexed again if its hash differs.
+struct file_stamp {
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	uint64_t hash = 0;
 
-		// Вычисляем границы сниппета
-		size_t start = (match_position > CONTEXT_BEFORE) ?
-			match_position - CONTEXT_BEFORE : 0;
-		size_t end = std::min(match_position + CONTEXT_AFTER, original_text.length());
+	bool same_size_and_time(const file_stamp& other) const { return size == other.size && mtime == other.mtime; }
+};
 
-		// Извлекаем сниппет
-		std::string snippet = original_text.substr(start, end - start);
-		std::string snippet_lower = text_lower.substr(start, end - start);
+static uint64_t content_hash(const char* data, size_t size) {
+	const size_t whole = size & ~(size_t)7;
+	uint8_t tail[8] = {};
+	std::memcpy(tail, data + whole, size - whole);
+	return index_checksum(index_checksum(INDEX_CHECKSUM_SEED ^ size, data, whole), tail, 8);
+}
 
-		// Выделяем термины
-		std::string highlighted = highlight_terms(snippet, snippet_lower, terms);
+// size and time only, the hash is left 0
+static file_stamp stamp_of(const fs::path& fp) {
+	file_stamp stamp;
+	std::error_code ec;
+	stamp.size = fs::file_size(fp, ec);
+	stamp.mtime = ec ? 0 : (int64_t)fs::last_write_time(fp, ec).time_since_epoch().count();
+	return stamp;
+}
 
-		// Добавляем многоточия если нужно
-		if (start > 0) highlighted = "..." + highlighted;
-		if (end < original_text.length()) highlighted += "...";
+// stamp_of() plus the content hash, for telling a touched file from an
+// edited one; the file is read, not mapped, as it may be changing
+static file_stamp full_stamp_of(const fs::path& fp) {
+	file_stamp stamp = stamp_of(fp);
+	mapped_file file;
+	if (file.open(fp.string(), true, MAPPED_FILE_NEVER_MAP)) stamp.hash = content_hash(file.data(), file.size());
+	return stamp;
+}
 
-		return highlighted;
+// Restores the dictionary, segments, document store, document paths and
+// file stamps from an index file built with the same settings; false if
+// there is none or it does not fit.
+static bool load_index(const std::string& path, uint64_t fingerprint, mapped_index_file& file, doc_list& docs,
+	std::vector<file_stamp>& stamps, term_dictionary& dictionary, segmented_index& index, document_store& store) {
+	string_table paths;
+	const uint64_t* stamp_words = nullptr;
+	size_t stamp_count = 0;
+	if (!file.open(path, fingerprint)) return false;
+	if (!dictionary.load(file) || !index.load(file) || !store.load(file) ||
+		!file.strings(section_tag("DPTH"), section_tag("DPTX"), paths) || paths.size() != index.document_count() ||
+		store.size() != paths.size() || !file.find(section_tag("DSTM"), stamp_words, stamp_count) ||
+		stamp_count != 3 * paths.size()) {
+		dictionary = term_dictionary();
+		store = document_store();
+		file.close();
+		return false;
 	}
+	for (size_t d = 0; d < paths.size(); ++d) {
+		docs.push_back(new doc_t(std::string(paths[d])));
+		stamps.push_back({ stamp_words[3 * d], (int64_t)stamp_words[3 * d + 1], stamp_words[3 * d + 2] });
+	}
+	return true;
+}
 
-	static std::string highlight_terms(const std::string& snippet,
-		const std::string& snippet_lower,
-		const std::unordered_set<std::string>& terms) {
-		std::string result = snippet;
-		int offset = 0; // Смещение из-за вставленных символов выделения
+// Writes everything load_index() reads; the segments have to be committed
+// with a flush first. Segment files merged away are deleted afterwards.
+static bool save_index(const std::string& path, uint64_t fingerprint, doc_list& docs, const std::vector<file_stamp>& stamps,
+	const term_dictionary& dictionary, segmented_index& index, const document_store& store) {
+	std::vector<std::string> paths;
+	std::vector<uint64_t> stamp_words;
+	for (size_t d = 0; d < docs.size(); ++d) {
+		paths.push_back(docs[d]->get_path());
+		stamp_words.push_back(stamps[d].size);
+		stamp_words.push_back((uint64_t)stamps[d].mtime);
+		stamp_words.push_back(stamps[d].hash);
+	}
 
-		// Сортируем термины по длине (от длинных к коротким)
-		std::vector<std::string> sorted_terms(terms.begin(), terms.end());
-		std::sort(sorted_terms.begin(), sorted_terms.end(),
-			[](const std::string& a, const std::string& b) {
-			return a.size() > b.size();
-		});
+	index_file_writer out;
+	dictionary.save(out);
+	if (!index.save(out)) return false;
+	store.save(out);
+	out.add_strings(section_tag("DPTH"), section_tag("DPTX"), paths);
+	out.add(section_tag("DSTM"), stamp_words);
+	if (!out.write(path, fingerprint)) return false;
+	index.remove_obsolete_files();
+	return true;
+}
 
-		// Ищем и выделяем все вхождения
-		for (const auto& term : sorted_terms) {
-			if (term.empty()) continue;
+// One file's share of ingestion: everything up to, but not including,
+// interning its stems, which has to happen in file order.
+struct ingested_file {
+	// taken before the file is read, a change while reading shows next time
+	file_stamp stamp;
+	std::vector<stem_count> stems;
+	// stem index of every term, only kept when positions are
+	std::vector<uint32_t> sequence;
+	// copy of the text for the document store
+	std::string text;
+	// warnings, printed when the file comes up for interning
+	std::string message;
+	bool skip = false;
+	bool ready = false;
+};
 
-			size_t pos = 0;
-			while (pos < snippet_lower.length()) {
-				size_t found_pos = snippet_lower.find(term, pos);
-				if (found_pos == std::string::npos) break;
+// The text is tokenized straight out of the mapping (or the worker's read
+// buffer for small files) and copied once, for the document store. Files
+// that may be changing, as in updates of a loaded or watched index, are
+// never mapped: set map to false for them.
+static ingested_file ingest_file(const fs::path& fp, bool positions, bool map = true) {
+	thread_local mapped_file file;
+	ingested_file r;
+	r.stamp = stamp_of(fp);
+	try {
+		if (!file.open(fp.string(), true, map ? MAPPED_FILE_MIN_MAP : MAPPED_FILE_NEVER_MAP)) {
+			r.message = "Warning: cannot open file: " + fp.string() + "\n";
+			r.skip = true;
+			return r;
+		}
+		if (file.size() == 0) {
+			std::error_code sz_ec;
+			auto sz = fs::file_size(fp, sz_ec);
+			if (sz_ec || sz == 0) {
+				if (sz_ec) r.message += "Warning: cannot stat file " + fp.string() + " : " + sz_ec.message() + "\n";
+				else r.message += "Info: skipping empty file " + fp.string() + "\n";
+				r.skip = true;
+				return r;
+			}
+		}
+		r.stamp.hash = content_hash(file.data(), file.size());
+		r.stems = count_stems(file.data(), file.size(), positions ? &r.sequence : nullptr);
+		r.text.assign(file.data(), file.size());
+		file.close();
+	}
+	catch (const std::exception& ex) {
+		file.close();
+		r.message += "Warning: exception reading file " + fp.string() + " : " + ex.what() + " -- skipping\n";
+		r.skip = true;
+	}
+	return r;
+}
 
-				// Вычисляем позиции с учетом предыдущих вставок
-				size_t adjusted_pos = found_pos + offset;
+// Workers read, tokenize, stem and count files concurrently while the
+// calling thread interns the results strictly in feed order, so term and
+// document ids come out exactly as in a serial run over the same order.
+// Files are taken as soon as discovery hands them to the feed; workers
+// stay at most a few files per thread ahead of the interning. If a worker
+// or the interning throws, the rest is abandoned and, once every worker
+// has been joined, the first exception is rethrown.
+static void ingest_files(path_feed& feed, size_t threads, bool positions, doc_list& docs,
+	std::vector<file_stamp>& stamps, term_dictionary& dictionary, document_store& store) {
+	// results not yet interned, by feed index
+	std::unordered_map<size_t, ingested_file> slots;
+	std::mutex lock;
+	std::condition_variable changed;
+	size_t next = 0, consumed = 0;
+	const size_t window = 4 * threads;
+	std::exception_ptr failure;
+	bool aborted = false;
+
+	auto abort = [&](std::exception_ptr error) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!failure) failure = error;
+			aborted = true;
+		}
+		changed.notify_all();
+	};
 
-				// Вставляем выделение
-				result.insert(adjusted_pos, "[");
-				size_t end_indx = adjusted_pos + 1;
-				while(end_indx < result.length() && isalpha(result.at(end_indx)))
-					end_indx += 1;
-				result.insert(end_indx, "]");
+	auto worker = [&]() {
+		try {
+			while (true) {
+				size_t i;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					changed.wait(guard, [&] { return aborted || next < consumed + window; });
+					if (aborted) return;
+					i = next++;
+				}
+				fs::path fp;
+				if (!feed.get(i, fp)) return;
+				ingested_file r = ingest_file(fp, positions);
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					slots[i] = std::move(r);
+					slots[i].ready = true;
+				}
+				changed.notify_all();
+			}
+		}
+		catch (...) {
+			abort(std::current_exception());
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) workers.emplace_back(worker);
 
-				offset += 2; // Добавили 2 символа: [ и ]
-				pos = found_pos + term.length();
+	try {
+		fs::path fp;
+		for (size_t i = 0; feed.get(i, fp); ++i) {
+			ingested_file r;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [&] { return aborted || slots[i].ready; });
+				if (aborted) break;
+				r = std::move(slots[i]);
+				slots.erase(i);
+				consumed = i + 1;
 			}
+			changed.notify_all();
+
+			std::cerr << r.message;
+			if (r.skip) continue;
+			docs.push_back(new doc_t(fp.string(), r.stems, dictionary, positions ? &r.sequence : nullptr));
+			store.add(r.text.data(), r.text.size(), docs.back()->get_terms(), docs.back()->get_first_offsets());
+			stamps.push_back(r.stamp);
+			#ifdef MEMORY_TESTS
+			std::cout << fp.string() << " | " << docs.back()->get_bytes_count() << " bytes" << std::endl; 
+			#endif
 		}
+	}
+	catch (...) {
+		abort(std::current_exception());
+	}
 
-		return result;
+	for (auto& w : workers) w.join();
+	if (failure) std::rethrow_exception(failure);
+}
+
+// Reads, tokenizes and indexes every file of the feed, then builds the
+// index as one segment.
+static bool build_index(path_feed& feed, size_t threads, doc_list& docs, std::vector<file_stamp>& stamps,
+	term_dictionary& dictionary, segmented_index& index, document_store& store) {
+	#ifdef TIME_TESTS
+		auto t_before = std::chrono::high_resolution_clock::now();
+	#endif
+	try {
+		ingest_files(feed, threads, index.has_positions(), docs, stamps, dictionary, store);
 	}
+	catch (const std::exception& ex) {
+		std::cerr << "Error reading documents: " << ex.what() << "\n";
+		return false;
+	}
+	#ifdef TIME_TESTS
+        auto t_after = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> t_delta = t_after - t_before; 
+        printf("Tokenization + Indexation: %.5f ms\n", t_delta);
+		#ifdef STEM_CACHE
+		const stem_cache_stats cache = shared_stem_cache().stats();
+		printf("Stem cache: %llu hits, %llu misses, %llu uncached (%.2f%% hits)\n", (unsigned long long)cache.hits,
+			(unsigned long long)cache.misses, (unsigned long long)cache.uncached, 100.0 * cache.hit_rate());
+		#endif
+	#endif
+	#ifdef MEMORY_TESTS
+	std::cout << "term dictionary | " << dictionary.size() << " terms | " << dictionary.get_bytes_count() << " bytes" << std::endl;
+	std::cout << "document store | " << store.size() << " documents | " << store.get_bytes_count() << " bytes" << std::endl;
+	#endif
 
-	static std::string truncate_text(const std::string& text, size_t max_length) {
-		if (text.length() <= max_length) {
-			return text;
-		}
-		return text.substr(0, max_length) + "...";
+	if (docs.empty()) {
+		std::cerr << "No readable documents to index.\n";
+		return false;
 	}
-public:
-	static constexpr size_t CONTEXT_BEFORE = 40;
-	static constexpr size_t CONTEXT_AFTER = 120;
-	static constexpr size_t MAX_SNIPPET_LEN = CONTEXT_BEFORE + CONTEXT_AFTER;
 
-	static std::string make_snippet(const doc_t* doc,
-		const std::vector<std::string>& query_tokens) {
-		const std::filesystem::path path = doc->get_path();
-		std::string text = read_file(path);
-		if (text.empty() || query_tokens.empty()) {
-			return truncate_text(text, MAX_SNIPPET_LEN);
-		}
+	#ifdef TIME_TESTS
+		t_before = std::chrono::high_resolution_clock::now();
+	#endif
+	try {
+		if (!index.build(docs, dictionary)) return false;
+	}
+	catch (const std::exception& ex) {
+		std::cerr << "Error building index: " << ex.what() << "\n";
+		return false;
+	}
+	#ifdef TIME_TESTS
+		std::chrono::duration<double, std::milli> t_build = std::chrono::high_resolution_clock::now() - t_before;
+		printf("Ranking index build: %.5f ms\n", t_build.count());
+	#endif
+	for (size_t d = 0; d < docs.size(); ++d) docs[d]->release_positions();
+	return true;
+}
+
+// Indexes one more file as the next document; false if it is skipped.
+// The file is read rather than mapped, it may be changing.
+static bool add_file(const fs::path& fp, doc_list& docs, std::vector<file_stamp>& stamps,
+	term_dictionary& dictionary, segmented_index& index, document_store& store) {
+	const bool positions = index.has_positions();
+	ingested_file r = ingest_file(fp, positions, false);
+	std::cerr << r.message;
+	if (r.skip) return false;
+	docs.push_back(new doc_t(fp.string(), r.stems, dictionary, positions ? &r.sequence : nullptr));
+	store.add(r.text.data(), r.text.size(), docs.back()->get_terms(), docs.back()->get_first_offsets());
+	stamps.push_back(r.stamp);
+	index.add(*docs.back());
+	return true;
+}
+
+// Publishes the changes so far; documents first and later were added since
+// the last commit and, once published, their positions live only in the
+// postings.
+static void commit_changes(segmented_index& index, doc_list& docs, size_t first) {
+	index.commit();
+	for (size_t d = first; d < docs.size(); ++d) docs[d]->release_positions();
+}
+
+// Takes document d out of the index and its occurrences out of the
+// dictionary; its path, text and stamp stay behind under the dead id
+// until compact_documents() drops them.
+static void remove_file(doc_id d, term_dictionary& dictionary, segmented_index& index, const document_store& store) {
+	const std::vector<term_count> terms = store.terms(d);
+	index.remove(d, terms);
+	for (const auto& kv : terms) dictionary.release(kv.first, kv.second);
+}
 
-		std::unordered_set<std::string> search_terms;
-		for (const auto& token : query_tokens) {
-			std::string stemmed = porter::get_stem(token);
-			if (!stemmed.empty()) {
-				search_terms.insert(stemmed);
+// What an update did: documents added and removed, and files found
+// touched but not edited, whose stamp was renewed.
+struct sync_counts {
+	size_t added = 0;
+	size_t removed = 0;
+	size_t renewed = 0;
+
+	bool any() const { return added != 0 || removed != 0 || renewed != 0; }
+};
+
+// path -> id of every document not removed
+static std::unordered_map<std::string, doc_id> live_documents(doc_list& docs, segmented_index& index) {
+	std::unordered_map<std::string, doc_id> live;
+	for (size_t d = 0; d < docs.size(); ++d) {
+		if (!index.is_removed((doc_id)d)) live.emplace(docs[d]->get_path(), (doc_id)d);
+	}
+	return live;
+}
+
+// Brings the index in line with the file at fp: its document is dropped
+// if the file is gone and replaced if the file changed, and a new file is
+// added. live is kept up to date.
+static void refresh_file(const fs::path& fp, std::unordered_map<std::string, doc_id>& live, doc_list& docs,
+	std::vector<file_stamp>& stamps, term_dictionary& dictionary, segmented_index& index, document_store& store, sync_counts& counts) {
+	std::error_code ec;
+	const bool exists = fs::is_regular_file(fp, ec);
+	auto it = live.find(fp.string());
+	if (it != live.end()) {
+		const doc_id d = it->second;
+		if (exists) {
+			const file_stamp now = stamp_of(fp);
+			if (stamps[d].same_size_and_time(now)) return;
+			if (now.size == stamps[d].size) {
+				const file_stamp full = full_stamp_of(fp);
+				if (full.hash == stamps[d].hash) {
+					stamps[d] = full;
+					counts.renewed += 1;
+					return;
+				}
 			}
-			search_terms.insert(token);
 		}
+		remove_file(d, dictionary, index, store);
+		live.erase(it);
+		counts.removed += 1;
+	}
+	if (exists && add_file(fp, docs, stamps, dictionary, index, store)) {
+		live.emplace(fp.string(), (doc_id)(docs.size() - 1));
+		counts.added += 1;
+	}
+}
 
-		std::string text_lower = to_lower_case(text);
-		size_t best_position = find_first_match(text_lower, search_terms);
+// Brings a loaded index in line with the files found now: documents whose
+// file is gone, no longer passes the filter or has changed are removed,
+// new and changed files are added, and the whole batch is then committed.
+static sync_counts sync_index(const std::vector<fs::path>& found, doc_list& docs, std::vector<file_stamp>& stamps,
+	term_dictionary& dictionary, segmented_index& index, document_store& store) {
+	sync_counts counts;
+	const size_t first_added = docs.size();
+	std::unordered_map<std::string, doc_id> live = live_documents(docs, index);
+	std::unordered_set<std::string> present;
+	for (const auto& fp : found) {
+		present.insert(fp.string());
+		refresh_file(fp, live, docs, stamps, dictionary, index, store, counts);
+	}
+	// not listed, whether or not the file is still there
+	for (const auto& kv : live) {
+		if (present.count(kv.first) != 0) continue;
+		remove_file(kv.second, dictionary, index, store);
+		counts.removed += 1;
+	}
+	commit_changes(index, docs, first_added);
+	return counts;
+}
 
-		if (best_position == std::string::npos) {
-			return truncate_text(text, MAX_SNIPPET_LEN);
+// Once enough document ids are dead, drops them for good: the index
+// renumbers the live documents on its worker and docs, stamps and store
+// follow. The renumbered copies are built while queries still run on the
+// old ids; only swapping them in holds lock. This thread must be the only
+// writer.
+static void compact_documents(std::mutex& lock, doc_list& docs, std::vector<file_stamp>& stamps, segmented_index& index,
+	document_store& store) {
+	if (!index.needs_compaction()) return;
+	std::vector<doc_id> kept;
+	if (!index.prepare_compaction(kept)) return;
+	document_store kept_store = store.compacted(kept);
+	std::vector<file_stamp> kept_stamps;
+	kept_stamps.reserve(kept.size());
+	for (doc_id d : kept) kept_stamps.push_back(stamps[d]);
+	std::lock_guard<std::mutex> guard(lock);
+	index.publish_compaction();
+	docs.keep(kept);
+	stamps.swap(kept_stamps);
+	store = std::move(kept_store);
+}
+
+// Flushes the segments and writes the index file, warning on failure.
+static void commit_and_save(const std::string& path, uint64_t fingerprint, doc_list& docs, const std::vector<file_stamp>& stamps,
+	const term_dictionary& dictionary, segmented_index& index, const document_store& store) {
+	index.commit(true);
+	if (!save_index(path, fingerprint, docs, stamps, dictionary, index, store)) {
+		std::cerr << "Warning: cannot write index file " << path << "\n";
+	}
+}
+
+// Adds a watch for every directory below root; the root is watched by
+// open().
+static void watch_directories(folder_watch& watch, const fs::path& root, const std::vector<fs::path>& directories) {
+	for (const auto& d : directories) {
+		const std::string relative = d.lexically_relative(root).generic_string();
+		if (relative != "." && !watch.watch_directory(relative)) {
+			std::cerr << "Warning: cannot watch " << d.string() << ", changes there are picked up on restart\n";
 		}
+	}
+}
 
-		return extract_context_with_highlight(text, text_lower, best_position, search_terms);
+// Watch mode saves once no change has come for SAVE_QUIET, or at the
+// latest SAVE_DELAY_MAX after the first change not yet saved.
+constexpr std::chrono::milliseconds SAVE_QUIET(2000);
+constexpr std::chrono::milliseconds SAVE_DELAY_MAX(30000);
+
+// Watch mode: until stop is set, every batch of changes the watch reports
+// under root is applied to the index holding lock, which queries take as
+// well. Only the files named in the batch are looked at, unless events
+// were lost or a directory came or went, and the whole tree is listed and
+// synced again. Saving happens once changes settle and on stop, outside
+// lock but for publishing a due compaction: queries only read, and this
+// thread is the only writer.
+static void watch_folder(folder_watch& watch, const fs::path& root, const path_filter& filter, size_t threads,
+	const std::atomic<bool>& stop, std::mutex& lock, const std::string& index_path, uint64_t fingerprint, doc_list& docs,
+	std::vector<file_stamp>& stamps, term_dictionary& dictionary, segmented_index& index, document_store& store) {
+	using clock = std::chrono::steady_clock;
+	std::vector<std::string> names;
+	bool rescan = false;
+	// changes not saved yet, and when the first and the last of them came
+	bool dirty = false;
+	clock::time_point first_change, last_change;
+	auto save = [&]() {
+		compact_documents(lock, docs, stamps, index, store);
+		commit_and_save(index_path, fingerprint, docs, stamps, dictionary, index, store);
+		dirty = false;
+	};
+	while (!stop) {
+		if (!watch.wait(200, names, rescan)) {
+			const clock::time_point now = clock::now();
+			if (dirty && (now - last_change >= SAVE_QUIET || now - first_change >= SAVE_DELAY_MAX)) save();
+			continue;
+		}
+		#ifdef TIME_TESTS
+			auto t_before = std::chrono::high_resolution_clock::now();
+		#endif
+		sync_counts counts;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (rescan) {
+				std::vector<fs::path> directories;
+				const std::vector<fs::path> found = find_files(root, filter, threads, &directories);
+				watch_directories(watch, root, directories);
+				counts = sync_index(found, docs, stamps, dictionary, index, store);
+			}
+			else {
+				const size_t first_added = docs.size();
+				std::unordered_map<std::string, doc_id> live = live_documents(docs, index);
+				for (const auto& name : names) {
+					if (filter.takes_file(name)) refresh_file(root / name, live, docs, stamps, dictionary, index, store, counts);
+				}
+				commit_changes(index, docs, first_added);
+			}
+		}
+		if (!counts.any()) continue;
+		last_change = clock::now();
+		if (!dirty) first_change = last_change;
+		dirty = true;
+		if (last_change - first_change >= SAVE_DELAY_MAX) save();
+		// files only touched change nothing a query can see
+		if (counts.added == 0 && counts.removed == 0) continue;
+		std::cout << "\n(folder changed: " << counts.added << " added, " << counts.removed << " removed)\n";
+		#ifdef TIME_TESTS
+			std::chrono::duration<double, std::milli> t_delta = std::chrono::high_resolution_clock::now() - t_before;
+			printf("Index updated: %.5f ms\n", t_delta.count());
+		#endif
+		std::cout << "Query> " << std::flush;
 	}
-};
+	if (dirty) save();
+}
+
+// Stems of every quoted part of a query that has at least two of them, in
+// order; an unclosed quote runs to the end of the query.
+static std::vector<std::vector<std::string>> quoted_phrases(const std::string& query) {
+	std::vector<std::vector<std::string>> phrases;
+	size_t open = query.find('"');
+	while (open != std::string::npos) {
+		const size_t close = query.find('"', open + 1);
+		auto terms = get_tokens(query.substr(open + 1, close == std::string::npos ? std::string::npos : close - open - 1));
+		if (terms.size() > 1) phrases.push_back(std::move(terms));
+		if (close == std::string::npos) break;
+		open = query.find('"', close + 1);
+	}
+	return phrases;
+}
+
+int main(int argc, char* argv[]) {
+	engine_options options;
+	if (!parse_options(argc, argv, options)) return 1;
 
-int main() {
 	std::string folder_path;
 	std::cout << "Enter folder path to scan for .txt files (empty = current dir):\n> ";
 	std::getline(std::cin, folder_path);
@@ -175,81 +800,103 @@ int main() {
 		return 1;
 	}
 
-	std::vector<fs::path> found;
-	auto push_if_txt = [&](const fs::path& p) {
-		std::string ext = p.extension().string();
-		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
-		if (ext == ".txt") found.push_back(p);
-	};
-
-	fs::directory_iterator iterator(root, error);
-	if (error) {
-		std::cerr << "Warning: cannot start directory iteration: " << error.message() << "\n";
-	}
-	else {
-		for (; iterator != fs::directory_iterator(); iterator.increment(error)) {
-			if (error) {
-				std::cerr << "Warning: error while iterating: " << error.message() << " -- skipping\n";
-				error.clear();
-				continue;
-			}
-			const fs::path p = iterator->path();
-			std::error_code is_ec;
-			if (!fs::is_regular_file(p, is_ec)) continue;
-			push_if_txt(p);
-		}
-	}
-	if (found.empty()) {
-		std::cerr << "No .txt files found under " << folder_path << "\n";
+	// the tree is listed while the index loads, or while the first files are
+	// already being indexed
+	path_feed feed;
+	std::vector<fs::path> directories;
+	std::thread discovery(discover_files, std::cref(root), std::cref(options.filter), options.threads, std::ref(feed), &directories);
+	fs::path first_file;
+	if (!feed.get(0, first_file)) {
+		discovery.join();
+		std::cerr << "No files matching the include patterns found under " << folder_path << "\n";
 		return 1;
 	}
 
-	std::cout << "Found " << found.size() << " .txt files. Indexing...\n";
+	std::cout << "Indexing...\n";
 	doc_list docs;
+	// views into the loaded index file, must outlive dictionary, index and store
+	mapped_index_file index_file;
+	const std::string index_path = options.index_path.empty() ? (root / ".search_index").string() : options.index_path;
+	const uint64_t fingerprint = index_fingerprint(options.codec, options.scoring, options.positions);
+	term_dictionary dictionary;
+	segmented_index index(index_path, fingerprint, options.codec, options.positions, options.scoring, options.threads);
+	document_store store;
+	// size, modification time and hash of every document's file, parallel to docs
+	std::vector<file_stamp> stamps;
 
 	#ifdef TIME_TESTS
 		auto t_before = std::chrono::high_resolution_clock::now();
 	#endif
-	for (const auto& fp : found) {
-		try {
-			std::string text = read_file(fp);
-			if (text.empty()) {
-				std::error_code sz_ec;
-				auto sz = fs::file_size(fp, sz_ec);
-				if (sz_ec || sz == 0) {
-					if (sz_ec) std::cerr << "Warning: cannot stat file " << fp.string() << " : " << sz_ec.message() << "\n";
-					else std::cerr << "Info: skipping empty file " << fp.string() << "\n";
-					continue;
-				}
-			}
-			doc_t* d = new doc_t(fp.string(), text);
-			docs.push_back(d);
-			#ifdef MEMORY_TESTS
-			std::cout << fp.string() << " | " << docs.back()->get_bytes_count() << " bytes" << std::endl; 
-			#endif
-		}
-		catch (const std::exception& ex) {
-			std::cerr << "Warning: exception reading file " << fp.string() << " : " << ex.what() << " -- skipping\n";
-			continue;
-		}
-	}
+	const bool loaded = !options.rebuild && load_index(index_path, fingerprint, index_file, docs, stamps, dictionary, index, store);
 	#ifdef TIME_TESTS
-        auto t_after = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> t_delta = t_after - t_before; 
-        printf("Tokenization + Indexation: %.5f ms\n", t_delta);
+	if (loaded) {
+		std::chrono::duration<double, std::milli> t_delta = std::chrono::high_resolution_clock::now() - t_before;
+		printf("Index loaded from %s, %zu segments: %.5f ms\n", index_path.c_str(), index.segment_count(), t_delta.count());
+	}
 	#endif
 
-	if (docs.empty()) {
-		std::cerr << "No readable documents to index.\n";
+	bool save = !loaded;
+	if (loaded) {
+		#ifdef TIME_TESTS
+			t_before = std::chrono::high_resolution_clock::now();
+		#endif
+		// files missing from the listing are removed, so sync needs all of it
+		const sync_counts counts = sync_index(feed.all(), docs, stamps, dictionary, index, store);
+		save = counts.any();
+		#ifdef TIME_TESTS
+		if (save) {
+			std::chrono::duration<double, std::milli> t_delta = std::chrono::high_resolution_clock::now() - t_before;
+			printf("Index updated, %zu added, %zu removed, %zu touched: %.5f ms\n", counts.added, counts.removed, counts.renewed, t_delta.count());
+		}
+		#endif
+	}
+	else if (!build_index(feed, options.threads, docs, stamps, dictionary, index, store)) {
+		discovery.join();
 		return 1;
 	}
+	discovery.join();
+	std::cout << "Found " << feed.all().size() << " files.\n";
+
+	// held by queries and by the watch thread while it updates the index,
+	// not while it saves
+	std::mutex engine_lock;
+	if (save) {
+		compact_documents(engine_lock, docs, stamps, index, store);
+		commit_and_save(index_path, fingerprint, docs, stamps, dictionary, index, store);
+	}
 
-	search_ranker ranker;
-	try {
-		ranker.build(docs);
+	#ifdef TIME_TESTS
+	if (options.bench) {
+		bench_retrieval(index, dictionary, shown_results_count);
+		// a loaded index has no forward lists to rebuild postings from
+		if (!loaded) {
+			bench_codecs(docs, dictionary);
+			// segment files of a scratch index, gone afterwards
+			std::error_code ec;
+			const fs::path scratch = fs::temp_directory_path(ec) / ("search_engine_bench." + std::to_string(fingerprint));
+			fs::create_directories(scratch, ec);
+			{
+				segmented_index commits((scratch / "index").string(), fingerprint, options.codec, false, options.scoring, options.threads);
+				bench_commits(commits, docs);
+			}
+			fs::remove_all(scratch, ec);
+		}
+		bench_stemmer(docs);
+		bench_tokenizer(docs);
 	}
-	catch (const std::exception& ex) {
-		std::cerr << "Error building index: " << ex.what() << "\n";
+	#endif
+
+	std::atomic<bool> stop_watching(false);
+	folder_watch watch;
+	std::thread watcher;
+	if (options.watch) {
+		if (!watch.open(root.string())) std::cerr << "Warning: cannot watch " << folder_path << ", changes are picked up on restart\n";
+		else {
+			watch_directories(watch, root, directories);
+			watcher = std::thread(watch_folder, std::ref(watch), std::cref(root), std::cref(options.filter), options.threads,
+				std::cref(stop_watching), std::ref(engine_lock), std::cref(index_path), fingerprint, std::ref(docs), std::ref(stamps),
+				std::ref(dictionary), std::ref(index), std::ref(store));
+		}
 	}
 
 	std::cout << "Indexing done. Enter queries (empty line to skip).\n\n";
@@ -259,6 +906,7 @@ int main() {
 		std::cout << "Query> ";
 		if (!std::getline(std::cin, user_input)) break;
 		if (user_input.empty()) continue;
+		std::lock_guard<std::mutex> guard(engine_lock);
 		#ifdef TIME_TESTS
 				auto t_before = std::chrono::high_resolution_clock::now();
 		#endif
@@ -268,7 +916,17 @@ int main() {
 			continue;
 		}
 
-		auto scores = ranker.rank_tokens(qtokens, shown_results_count);
+		const std::vector<term_id> qterms = dictionary.find(qtokens);
+		// unknown phrase terms stay as NO_TERM so that the phrase matches nothing
+		std::vector<std::vector<term_id>> phrases;
+		for (const auto& phrase : quoted_phrases(user_input)) {
+			phrases.emplace_back();
+			for (const auto& stem : phrase) phrases.back().push_back(dictionary.find(stem));
+		}
+		if (!phrases.empty() && !index.has_positions()) {
+			std::cout << "(index has no positions, phrases are matched as plain terms; rebuild with --positions)\n";
+		}
+		auto scores = index.rank_query(qterms, phrases, shown_results_count, options.mode);
 		if (scores.empty()) {
 			std::cout << "No matching documents.\n";
 			continue;
@@ -278,15 +936,18 @@ int main() {
         std::chrono::duration<double, std::milli> t_delta = t_after - t_before; 
         printf("Query analysis: %.5f ms\n", t_delta);
 		#endif
+		const stem_matcher matcher(qtokens);
 		for (size_t r = 0; r < scores.size(); ++r) {
 			double score = scores[r].first;
 			size_t docidx = scores[r].second;
 			if (docidx >= docs.size()) continue;
 			std::cout << (r + 1) << ". [" << score << "] " << docs[docidx]->get_path() << "\n";
-			SnippetGenerator generator;
-			std::string snippet = SnippetGenerator::make_snippet(docs[docidx], qtokens);
+			std::string snippet = SnippetGenerator::make_snippet(store, docidx, matcher, qterms);
 			std::cout << "<" << (snippet.size() > 150 ? snippet.substr(0, 150) + ">" : snippet) << "\n";
 		}
 	}
+
+	stop_watching = true;
+	if (watcher.joinable()) watcher.join();
 	return 0;
 }
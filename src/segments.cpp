@@ -0,0 +1,730 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <cstdio>
+#include <cctype>
+#include <filesystem>
+#include "document_store.cpp"
+
+// documents kept in the in-memory segment before it is written out
+#define SEGMENT_FLUSH_DOCUMENTS 256
+// number of segments of one size tier merged into one
+#define SEGMENT_MERGE_FACTOR 4
+// share of dead document ids, in percent, past which compaction is due
+#define SEGMENT_COMPACT_PERCENT 25
+// documents added and removed since every segment was last scored, in
+// percent of the live ones, past which all of them are scored again
+#define SEGMENT_RESCORE_PERCENT 10
+// removed documents a segment hides before it is scored again on its own
+#define SEGMENT_HIDDEN_MAX 64
+
+// Log-structured index. Documents live in segments, each a search_ranker
+// over a contiguous range of document ids, numbered from 0 inside it.
+// Every segment but the newest is written to a file of its own
+// (<index>.seg<N>, a complete index file) and never changes; the newest
+// may be the in-memory segment collecting recent additions.
+//
+// add() and remove() only record the change. A background thread folds
+// changes into the in-memory segment, writes it out once it holds
+// SEGMENT_FLUSH_DOCUMENTS documents, merges the newest
+// SEGMENT_MERGE_FACTOR files whenever they are of the same size tier
+// (dropping the postings of removed documents on the way), and publishes
+// the result as a new snapshot. Queries take the current snapshot without
+// waiting for any of this, rank every segment and merge the top-k lists.
+//
+// Scores use collection-wide statistics: a segment is scored against the
+// idf, and under bm25 the average document length, of the moment, which
+// recomputes its norms or impacts and bounds from the postings. A cycle
+// only scores the segments it makes or changes, the others are shared
+// with the previous snapshot as they are. All of them are scored again
+// once the documents added and removed since the last time pass
+// SEGMENT_RESCORE_PERCENT of the live ones, and on commit(true), so the
+// statistics never drift far and save() finds every segment scored alike.
+// Removed documents keep their postings until a merge and are hidden by
+// an infinite norm or zero impacts once their segment is scored; until
+// then their segment asks for more results and they are filtered out.
+// Their ids stay taken until a compaction renumbers the live documents,
+// see prepare_compaction().
+// The index file written by save() holds these scores for all segments.
+class segmented_index {
+private:
+	struct segment {
+		doc_id base = 0;
+		size_t count = 0;
+		// file <path>.seg<number>, null while the segment is in memory
+		std::shared_ptr<mapped_index_file> file;
+		uint32_t number = 0;
+		// shared by every snapshot holding the segment unchanged, a change
+		// works on a copy
+		std::shared_ptr<search_ranker> ranker;
+		// idf the ranker was scored against and views; null until scored
+		std::shared_ptr<const stored_vector<double>> idf;
+		// documents removed since then, left to merge_top_k() to filter
+		size_t hidden = 0;
+	};
+
+	// what queries see, never changed once published
+	struct snapshot {
+		// ascending, without gaps
+		std::vector<segment> segments;
+		// of the latest scoring
+		std::shared_ptr<const stored_vector<double>> idf;
+		std::vector<uint32_t> df;
+		// removed flag of every document
+		std::vector<uint8_t> removed;
+		size_t documents = 0;
+		// every segment scored against idf and hiding nothing, as save() needs
+		bool settled = true;
+	};
+
+	std::string path_;
+	uint64_t fingerprint_ = 0;
+	postings_codec codec_ = postings_codec::raw;
+	bool positions_ = false;
+	scorer scorer_;
+	size_t threads_ = 1;
+
+	// everything below is guarded by lock_
+	std::mutex lock_;
+	std::condition_variable changed_;
+	std::shared_ptr<const snapshot> current_;
+	// changes not yet published: document frequencies and removed flags of
+	// every document handed out, and the documents added since the last cycle
+	std::vector<uint32_t> df_;
+	std::vector<uint8_t> removed_;
+	size_t live_documents_ = 0;
+	// tokens in the live documents, for the bm25 average length
+	uint64_t total_length_ = 0;
+	std::vector<const doc_t*> pending_;
+	// removed since the last cycle
+	std::vector<doc_id> newly_removed_;
+	// documents added and removed since every segment was last scored
+	size_t drift_ = 0;
+	size_t memtable_documents_ = 0;
+	// change counters, a commit() waits for published_ to reach submitted_
+	uint64_t submitted_ = 0;
+	uint64_t published_ = 0;
+	bool commit_waiting_ = false;
+	bool flush_requested_ = false;
+	// prepare_compaction() waits for the worker to clear the request; the
+	// index built, null if there was none, and the old ids it keeps
+	bool compaction_requested_ = false;
+	bool compaction_ready_ = false;
+	std::shared_ptr<const snapshot> compaction_;
+	std::vector<doc_id> compaction_kept_;
+	// files of segments merged away, deleted once an index file without
+	// them has been saved
+	std::vector<uint32_t> obsolete_;
+	bool stop_ = false;
+
+	// used by the worker, and by build() and load() while it is idle
+	uint32_t next_number_ = 0;
+	std::thread worker_;
+
+	std::string segment_path(uint32_t number) const { return path_ + ".seg" + std::to_string(number); }
+
+	// numbers of the segment files next to the index file, whichever
+	// index they belong to
+	std::vector<uint32_t> segment_files() const {
+		std::vector<uint32_t> numbers;
+		const std::filesystem::path index(path_);
+		const std::string prefix = index.filename().string() + ".seg";
+		std::error_code error;
+		std::filesystem::directory_iterator it(index.has_parent_path() ? index.parent_path() : std::filesystem::path("."), error);
+		for (; !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+			const std::string name = it->path().filename().string();
+			if (name.size() <= prefix.size() || name.size() > prefix.size() + 9 || name.compare(0, prefix.size(), prefix) != 0) continue;
+			if (!std::all_of(name.begin() + prefix.size(), name.end(), [](unsigned char ch) { return std::isdigit(ch) != 0; })) continue;
+			numbers.push_back((uint32_t)std::stoul(name.substr(prefix.size())));
+		}
+		return numbers;
+	}
+
+	static uint64_t document_length(const std::vector<term_count>& terms) {
+		uint64_t length = 0;
+		for (const auto& kv : terms) length += kv.second;
+		return length;
+	}
+
+	search_ranker make_ranker() const {
+		search_ranker ranker;
+		ranker.set_postings_codec(codec_);
+		ranker.set_positions(positions_);
+		ranker.set_scorer(scorer_);
+		ranker.set_build_threads(threads_);
+		return ranker;
+	}
+
+	// idf of every term from the document frequencies and live documents
+	std::shared_ptr<const stored_vector<double>> make_idf(const std::vector<uint32_t>& df, size_t live) const {
+		auto idf = std::make_shared<stored_vector<double>>();
+		auto& values = idf->reset();
+		values.resize(df.size());
+		for (size_t t = 0; t < values.size(); ++t) values[t] = scorer_.inverse_document_frequency(df[t], live);
+		return idf;
+	}
+
+	// scores s against idf, on a copy of its ranker unless it was made
+	// since it was last scored and nothing shares it yet
+	void score_segment(segment& s, const std::shared_ptr<const stored_vector<double>>& idf, const std::vector<uint8_t>& removed,
+		double average_length) {
+		if (s.idf != nullptr) s.ranker = std::make_shared<search_ranker>(*s.ranker);
+		s.ranker->rescore(idf->data(), idf->size(), [&](doc_id d) { return removed[s.base + d] != 0; }, average_length);
+		s.idf = idf;
+		s.hidden = 0;
+	}
+
+	// size tier: segments of up to FLUSH * FACTOR^(i+1) documents are in tier i
+	static size_t tier(size_t count) {
+		size_t t = 0;
+		for (size_t limit = SEGMENT_FLUSH_DOCUMENTS * SEGMENT_MERGE_FACTOR; count > limit; limit *= SEGMENT_MERGE_FACTOR) ++t;
+		return t;
+	}
+
+	// Writes s out and maps it back in place of its owned arrays; on
+	// failure s stays in memory and the next save() fails.
+	bool write_segment(segment& s) {
+		s.number = next_number_++;
+		index_file_writer out;
+		s.ranker->save(out);
+		auto file = std::make_shared<mapped_index_file>();
+		search_ranker loaded = make_ranker();
+		if (!out.write(segment_path(s.number), fingerprint_) || !file->open(segment_path(s.number), fingerprint_) || !loaded.load(*file)) {
+			std::cerr << "Warning: cannot write index segment " << segment_path(s.number) << "\n";
+			return false;
+		}
+		s.file = file;
+		s.ranker = std::make_shared<search_ranker>(std::move(loaded));
+		s.idf = nullptr;
+		s.hidden = 0;
+		return true;
+	}
+
+	// merges the newest SEGMENT_MERGE_FACTOR files while they share a tier
+	void merge_segments(std::vector<segment>& segments, size_t vocabulary, const std::vector<uint8_t>& removed,
+		std::vector<uint32_t>& obsolete) {
+		while (true) {
+			size_t end = segments.size();
+			if (end != 0 && segments[end - 1].file == nullptr) --end;
+			if (end < SEGMENT_MERGE_FACTOR) return;
+			const size_t first = end - SEGMENT_MERGE_FACTOR;
+			bool same_tier = true;
+			for (size_t i = first; i < end; ++i) {
+				same_tier = same_tier && segments[i].file != nullptr && tier(segments[i].count) == tier(segments[first].count);
+			}
+			if (!same_tier) return;
+
+			segment merged;
+			merged.base = segments[first].base;
+			std::vector<const search_ranker*> parts;
+			std::vector<doc_id> bases;
+			for (size_t i = first; i < end; ++i) {
+				parts.push_back(segments[i].ranker.get());
+				bases.push_back(segments[i].base - merged.base);
+				merged.count += segments[i].count;
+			}
+			merged.ranker = std::make_shared<search_ranker>(make_ranker());
+			merged.ranker->merge(parts, bases, merged.count, vocabulary,
+				[&](doc_id d) { return removed[merged.base + d] != 0; });
+			if (!write_segment(merged)) return;
+
+			for (size_t i = first; i < end; ++i) obsolete.push_back(segments[i].number);
+			segments.erase(segments.begin() + first, segments.begin() + end);
+			segments.insert(segments.begin() + first, std::move(merged));
+		}
+	}
+
+	// one round of background work, see the class comment
+	void run_cycle(std::unique_lock<std::mutex>& guard) {
+		const uint64_t target = submitted_;
+		const bool flush = flush_requested_;
+		flush_requested_ = false;
+		std::vector<const doc_t*> added;
+		added.swap(pending_);
+		std::vector<doc_id> newly_removed;
+		newly_removed.swap(newly_removed_);
+		auto next = std::make_shared<snapshot>();
+		next->df = df_;
+		next->removed = removed_;
+		next->documents = removed_.size();
+		const std::vector<uint8_t>& removed = next->removed;
+		const size_t live = live_documents_;
+		const double average_length = live == 0 ? 0.0 : (double)total_length_ / (double)live;
+		const bool rescore_all = flush || drift_ * 100 >= std::max<size_t>(1, live) * SEGMENT_RESCORE_PERCENT;
+		if (rescore_all) drift_ = 0;
+		std::shared_ptr<const snapshot> previous = current_;
+		guard.unlock();
+
+		std::vector<segment>& segments = next->segments;
+		if (previous) segments = previous->segments;
+		for (doc_id d : newly_removed) {
+			for (auto& s : segments) {
+				if (d >= s.base && d - s.base < s.count) s.hidden += 1;
+			}
+		}
+		if (!added.empty()) {
+			if (segments.empty() || segments.back().file != nullptr) {
+				segment fresh;
+				fresh.base = segments.empty() ? 0 : segments.back().base + (doc_id)segments.back().count;
+				fresh.ranker = std::make_shared<search_ranker>(make_ranker());
+				segments.push_back(std::move(fresh));
+			}
+			segment& memtable = segments.back();
+			if (memtable.idf != nullptr) memtable.ranker = std::make_shared<search_ranker>(*memtable.ranker);
+			memtable.idf = nullptr;
+			for (const doc_t* doc : added) memtable.ranker->add_document(*doc);
+			memtable.count += added.size();
+			memtable.ranker->apply_updates(next->df.size());
+		}
+		if (!segments.empty() && segments.back().file == nullptr &&
+			(flush || segments.back().count >= SEGMENT_FLUSH_DOCUMENTS)) write_segment(segments.back());
+		std::vector<uint32_t> obsolete;
+		merge_segments(segments, next->df.size(), removed, obsolete);
+
+		std::shared_ptr<const stored_vector<double>> idf;
+		for (auto& s : segments) {
+			if (!rescore_all && s.idf != nullptr && s.hidden <= SEGMENT_HIDDEN_MAX) continue;
+			if (!idf) idf = make_idf(next->df, live);
+			score_segment(s, idf, removed, average_length);
+		}
+		next->idf = idf ? idf : previous ? previous->idf : make_idf(next->df, live);
+		for (const auto& s : segments) next->settled = next->settled && s.idf == next->idf && s.hidden == 0;
+
+		guard.lock();
+		current_ = next;
+		memtable_documents_ = !segments.empty() && segments.back().file == nullptr ? segments.back().count : 0;
+		obsolete_.insert(obsolete_.end(), obsolete.begin(), obsolete.end());
+		published_ = target;
+		changed_.notify_all();
+	}
+
+	std::shared_ptr<const snapshot> current() {
+		std::lock_guard<std::mutex> guard(lock_);
+		return current_;
+	}
+
+	// top-k over every segment of the current snapshot, rank(ranker, k)
+	// giving a segment's own; a segment hiding removed documents is asked
+	// for as many more and they are dropped
+	template <class rank_fn>
+	std::vector<score_pair> merge_top_k(size_t top_results_count, rank_fn rank) {
+		const std::shared_ptr<const snapshot> view = current();
+		top_k_results top(top_results_count);
+		if (!view) return top.take();
+		for (const auto& s : view->segments) {
+			for (const auto& [score, d] : rank(*s.ranker, top_results_count + s.hidden)) {
+				if (s.hidden != 0 && view->removed[s.base + d]) continue;
+				top.push(score, s.base + d);
+			}
+		}
+		return top.take();
+	}
+
+	// what prepare_compaction() asks for: the current snapshot, every
+	// change in it, merged into one renumbered segment, left unpublished
+	void run_compaction(std::unique_lock<std::mutex>& guard) {
+		const std::shared_ptr<const snapshot> previous = current_;
+		const size_t live = live_documents_;
+		const double average_length = live == 0 ? 0.0 : (double)total_length_ / (double)live;
+		guard.unlock();
+
+		std::vector<doc_id> kept;
+		std::shared_ptr<snapshot> next;
+		bool ok = true;
+		if (previous) {
+			const std::vector<uint8_t>& removed = previous->removed;
+			for (size_t d = 0; d < removed.size(); ++d) {
+				if (!removed[d]) kept.push_back((doc_id)d);
+			}
+			next = std::make_shared<snapshot>();
+			next->df = previous->df;
+			next->documents = kept.size();
+			next->removed.assign(kept.size(), 0);
+			next->idf = make_idf(next->df, live);
+			if (!kept.empty()) {
+				segment merged;
+				std::vector<const search_ranker*> parts;
+				std::vector<doc_id> bases;
+				for (const auto& s : previous->segments) {
+					parts.push_back(s.ranker.get());
+					bases.push_back(s.base);
+				}
+				merged.ranker = std::make_shared<search_ranker>(make_ranker());
+				merged.ranker->merge(parts, bases, removed.size(), next->df.size(), [&](doc_id d) { return removed[d] != 0; }, true);
+				merged.count = kept.size();
+				ok = write_segment(merged);
+				if (ok) {
+					score_segment(merged, next->idf, next->removed, average_length);
+					next->segments.push_back(std::move(merged));
+				}
+			}
+		}
+
+		guard.lock();
+		compaction_ = ok ? next : nullptr;
+		compaction_kept_.swap(kept);
+		compaction_ready_ = ok;
+		compaction_requested_ = false;
+		changed_.notify_all();
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> guard(lock_);
+		while (true) {
+			changed_.wait(guard, [this] {
+				return stop_ || compaction_requested_ || (published_ < submitted_ &&
+					(commit_waiting_ || pending_.size() + memtable_documents_ >= SEGMENT_FLUSH_DOCUMENTS));
+			});
+			if (stop_) return;
+			if (compaction_requested_) {
+				run_compaction(guard);
+				continue;
+			}
+			commit_waiting_ = false;
+			run_cycle(guard);
+		}
+	}
+public:
+	// Segment files are named after path, the index file, and carry
+	// fingerprint like it. Every segment is built with the given codec,
+	// positions setting, scorer and worker threads.
+	segmented_index(const std::string& path, uint64_t fingerprint, postings_codec codec, bool positions, const scorer& scoring,
+		size_t threads)
+		: path_(path), fingerprint_(fingerprint), codec_(codec), positions_(positions), scorer_(scoring),
+		threads_(std::max<size_t>(1, threads)) {
+		worker_ = std::thread([this] { run(); });
+	}
+
+	segmented_index(const segmented_index&) = delete;
+
+	segmented_index& operator=(const segmented_index&) = delete;
+
+	~segmented_index() {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			stop_ = true;
+		}
+		changed_.notify_all();
+		worker_.join();
+	}
+
+	bool has_positions() const { return positions_; }
+
+	// Replaces the index with a single segment built from docs in one go,
+	// the fast path for a whole collection; published at once. Segment
+	// files already on disk, of this index or of one it replaces, are
+	// neither reused nor kept: they go once the next save() is written.
+	bool build(doc_list& docs, const term_dictionary& dictionary) {
+		commit();
+		segment bulk;
+		bulk.ranker = std::make_shared<search_ranker>(make_ranker());
+		bulk.ranker->build(docs, dictionary);
+		bulk.count = docs.size();
+		const std::vector<uint32_t> replaced = segment_files();
+		next_number_ = 0;
+		for (uint32_t number : replaced) next_number_ = std::max(next_number_, number + 1);
+		if (!write_segment(bulk)) return false;
+
+		auto next = std::make_shared<snapshot>();
+		next->documents = docs.size();
+		next->removed.assign(docs.size(), 0);
+		next->df.resize(dictionary.size());
+		for (size_t t = 0; t < next->df.size(); ++t) next->df[t] = (uint32_t)bulk.ranker->document_frequency((term)t);
+		next->idf = make_idf(next->df, docs.size());
+		// a lone segment scored with its own statistics has the global ones
+		bulk.idf = next->idf;
+		next->segments.push_back(std::move(bulk));
+		uint64_t total_length = 0;
+		for (size_t d = 0; d < docs.size(); ++d) total_length += document_length(docs[d]->get_terms());
+
+		std::lock_guard<std::mutex> guard(lock_);
+		df_ = next->df;
+		removed_.assign(docs.size(), 0);
+		live_documents_ = docs.size();
+		total_length_ = total_length;
+		obsolete_.insert(obsolete_.end(), replaced.begin(), replaced.end());
+		pending_.clear();
+		newly_removed_.clear();
+		drift_ = 0;
+		memtable_documents_ = 0;
+		current_ = next;
+		published_ = submitted_;
+		return true;
+	}
+
+	// Appends doc as the next document id, which is returned; doc must stay
+	// alive as long as the index. Visible after the next commit() or once
+	// enough documents have piled up for a flush.
+	doc_id add(const doc_t& doc) {
+		std::lock_guard<std::mutex> guard(lock_);
+		const doc_id d = (doc_id)removed_.size();
+		removed_.push_back(0);
+		live_documents_ += 1;
+		total_length_ += document_length(doc.get_terms());
+		for (const auto& kv : doc.get_terms()) {
+			if (kv.first >= df_.size()) df_.resize(kv.first + 1, 0);
+			df_[kv.first] += 1;
+		}
+		pending_.push_back(&doc);
+		drift_ += 1;
+		submitted_ += 1;
+		if (pending_.size() + memtable_documents_ >= SEGMENT_FLUSH_DOCUMENTS) changed_.notify_all();
+		return d;
+	}
+
+	// Drops document d, whose terms are given as (term id, frequency); the
+	// id is not reused. Visible like add().
+	void remove(doc_id d, const std::vector<term_count>& terms) {
+		std::lock_guard<std::mutex> guard(lock_);
+		if (d >= removed_.size() || removed_[d]) return;
+		removed_[d] = 1;
+		live_documents_ -= 1;
+		total_length_ -= std::min(total_length_, document_length(terms));
+		for (const auto& kv : terms) {
+			if (kv.first < df_.size() && df_[kv.first] != 0) df_[kv.first] -= 1;
+		}
+		newly_removed_.push_back(d);
+		drift_ += 1;
+		submitted_ += 1;
+	}
+
+	// Whether enough ids are dead for a compaction to be worth a merge of
+	// everything: SEGMENT_COMPACT_PERCENT of all of them, and at least
+	// SEGMENT_FLUSH_DOCUMENTS.
+	bool needs_compaction() {
+		std::lock_guard<std::mutex> guard(lock_);
+		const size_t dead = removed_.size() - live_documents_;
+		return dead >= SEGMENT_FLUSH_DOCUMENTS && dead * 100 >= removed_.size() * SEGMENT_COMPACT_PERCENT;
+	}
+
+	// Drops removed documents for good, in two steps. The first builds on
+	// the worker, from the current snapshot and while queries go on, an
+	// index of one segment, written out, in which the live documents are
+	// numbered from 0 in id order, and waits for it; kept receives the old
+	// id of every document in its new order, for the caller to renumber
+	// what it keeps per document. publish_compaction() then swaps it in at
+	// once. No add() or remove() may come in between. False, with nothing
+	// to publish, if the merged segment cannot be written.
+	bool prepare_compaction(std::vector<doc_id>& kept) {
+		commit();
+		std::unique_lock<std::mutex> guard(lock_);
+		compaction_requested_ = true;
+		changed_.notify_all();
+		changed_.wait(guard, [this] { return !compaction_requested_; });
+		kept.swap(compaction_kept_);
+		compaction_kept_.clear();
+		return compaction_ready_;
+	}
+
+	// Publishes what prepare_compaction() built; the replaced segment
+	// files go once the next save() is written.
+	void publish_compaction() {
+		std::lock_guard<std::mutex> guard(lock_);
+		if (!compaction_ready_) return;
+		compaction_ready_ = false;
+		if (!compaction_) return;
+		for (const auto& s : current_->segments) {
+			if (s.file != nullptr) obsolete_.push_back(s.number);
+		}
+		removed_.assign(compaction_->documents, 0);
+		newly_removed_.clear();
+		drift_ = 0;
+		memtable_documents_ = 0;
+		current_ = std::move(compaction_);
+	}
+
+	// Waits until every change so far is published. With flush the
+	// in-memory segment is written out as well and every segment scored
+	// against the same statistics, as save() needs.
+	void commit(bool flush = false) {
+		std::unique_lock<std::mutex> guard(lock_);
+		if (flush && (published_ != submitted_ || memtable_documents_ + pending_.size() != 0 || (current_ && !current_->settled))) {
+			flush_requested_ = true;
+			submitted_ += 1;
+		}
+		if (published_ == submitted_) return;
+		const uint64_t target = submitted_;
+		commit_waiting_ = true;
+		changed_.notify_all();
+		changed_.wait(guard, [&] { return published_ >= target; });
+	}
+
+	// Ranks every segment of the current snapshot like
+	// search_ranker::rank_query() and merges their top-k lists; document
+	// ids are global. With positions, a plain query reranks the best
+	// PROXIMITY_RERANK * k of every segment rather than of the whole index.
+	std::vector<score_pair> rank_query(const std::vector<term>& tokens, const std::vector<std::vector<term>>& phrases,
+		size_t top_results_count = 10, retrieval_mode mode = retrieval_mode::exhaustive) {
+		return merge_top_k(top_results_count, [&](const search_ranker& ranker, size_t k) {
+			return ranker.rank_query(tokens, phrases, k, mode);
+		});
+	}
+
+	std::vector<score_pair> rank_tokens(const std::vector<term>& tokens, size_t top_results_count = 10,
+		retrieval_mode mode = retrieval_mode::exhaustive) {
+		return merge_top_k(top_results_count, [&](const search_ranker& ranker, size_t k) {
+			return ranker.rank_tokens(tokens, k, mode);
+		});
+	}
+
+	size_t segment_count() {
+		const std::shared_ptr<const snapshot> view = current();
+		return view ? view->segments.size() : 0;
+	}
+
+	// as of the last change, published or not
+	size_t document_frequency(term t) {
+		std::lock_guard<std::mutex> guard(lock_);
+		return t < df_.size() ? df_[t] : 0;
+	}
+
+	bool is_removed(doc_id d) {
+		std::lock_guard<std::mutex> guard(lock_);
+		return d < removed_.size() && removed_[d] != 0;
+	}
+
+	// every document id handed out, removed ones included
+	size_t document_count() {
+		std::lock_guard<std::mutex> guard(lock_);
+		return removed_.size();
+	}
+
+	// Adds the segment table and the scores of every segment of the
+	// current snapshot to out; false unless it holds every change and
+	// every segment has its file and is scored alike, see commit(true).
+	// The data is copied, out does not depend on the index.
+	bool save(index_file_writer& out) {
+		std::shared_ptr<const snapshot> view;
+		uint64_t total_length = 0;
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			if (published_ != submitted_ || !current_ || !current_->settled || current_->documents != removed_.size()) return false;
+			view = current_;
+			total_length = total_length_;
+		}
+		std::vector<uint64_t> table;
+		std::vector<double> norms;
+		std::vector<uint8_t> removed;
+		std::vector<float> block_max, max_impact;
+		std::vector<uint16_t> impacts;
+		for (const auto& s : view->segments) {
+			if (s.file == nullptr) return false;
+			const postings_index& postings = s.ranker->postings();
+			table.insert(table.end(), { (uint64_t)s.base, (uint64_t)s.count, (uint64_t)s.number,
+				(uint64_t)postings.block_maxima().size(), (uint64_t)postings.max_impacts().size(), (uint64_t)postings.impacts().size() });
+			norms.insert(norms.end(), s.ranker->document_norms().begin(), s.ranker->document_norms().end());
+			for (size_t d = 0; d < s.count; ++d) removed.push_back(s.ranker->is_removed((doc_id)d) ? 1 : 0);
+			block_max.insert(block_max.end(), postings.block_maxima().begin(), postings.block_maxima().end());
+			max_impact.insert(max_impact.end(), postings.max_impacts().begin(), postings.max_impacts().end());
+			impacts.insert(impacts.end(), postings.impacts().begin(), postings.impacts().end());
+		}
+		out.add_copy(section_tag("GSEG"), table);
+		out.add_copy(section_tag("GIDF"), std::vector<double>(view->idf->begin(), view->idf->end()));
+		out.add_copy(section_tag("GDF "), view->df);
+		out.add_copy(section_tag("GNRM"), norms);
+		out.add_copy(section_tag("GDEL"), removed);
+		out.add_copy(section_tag("GBMX"), block_max);
+		out.add_copy(section_tag("GMAX"), max_impact);
+		out.add_copy(section_tag("GIMP"), impacts);
+		out.add_copy(section_tag("GLEN"), std::vector<uint64_t>{ total_length });
+		return true;
+	}
+
+	// Deletes the files of merged segments; call once an index file from
+	// save() has been written, as the previous one may still name them.
+	void remove_obsolete_files() {
+		std::vector<uint32_t> obsolete;
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			obsolete.swap(obsolete_);
+		}
+		for (uint32_t number : obsolete) std::remove(segment_path(number).c_str());
+	}
+
+	// Restores the segments listed in an index file from save() and their
+	// files, views in place like the rest of the index; in must stay open
+	// as long as the index. False if anything is missing or does not fit.
+	bool load(const mapped_index_file& in) {
+		commit();
+		const uint64_t* table = nullptr;
+		const double* idf = nullptr;
+		const uint32_t* df = nullptr;
+		const double* norms = nullptr;
+		const uint8_t* removed = nullptr;
+		const float* block_max = nullptr;
+		const float* max_impact = nullptr;
+		const uint16_t* impacts = nullptr;
+		const uint64_t* total_length = nullptr;
+		size_t table_n = 0, terms = 0, df_n = 0, documents = 0, removed_n = 0, blocks = 0, impact_terms = 0, postings = 0, length_n = 0;
+		if (!in.find(section_tag("GSEG"), table, table_n) || !in.find(section_tag("GIDF"), idf, terms) ||
+			!in.find(section_tag("GDF "), df, df_n) || !in.find(section_tag("GNRM"), norms, documents) ||
+			!in.find(section_tag("GDEL"), removed, removed_n) || !in.find(section_tag("GBMX"), block_max, blocks) ||
+			!in.find(section_tag("GMAX"), max_impact, impact_terms) || !in.find(section_tag("GIMP"), impacts, postings) ||
+			!in.find(section_tag("GLEN"), total_length, length_n)) return false;
+		if (table_n % 6 != 0 || df_n != terms || removed_n != documents || length_n != 1) return false;
+
+		auto next = std::make_shared<snapshot>();
+		auto idf_view = std::make_shared<stored_vector<double>>();
+		idf_view->view(idf, terms);
+		next->idf = idf_view;
+		next->df.assign(df, df + df_n);
+		next->removed.assign(removed, removed + documents);
+		next->documents = documents;
+		size_t block_at = 0, impact_at = 0, posting_at = 0;
+		uint32_t next_number = 0;
+		for (size_t i = 0; i < table_n; i += 6) {
+			segment s;
+			s.base = (doc_id)table[i];
+			s.count = (size_t)table[i + 1];
+			s.number = (uint32_t)table[i + 2];
+			const size_t segment_blocks = (size_t)table[i + 3], segment_terms = (size_t)table[i + 4];
+			const size_t segment_postings = (size_t)table[i + 5];
+			const doc_id expected = next->segments.empty() ? 0 : next->segments.back().base + (doc_id)next->segments.back().count;
+			if (s.base != expected || s.count > documents - s.base || segment_blocks > blocks - block_at ||
+				segment_terms > impact_terms - impact_at || segment_postings > postings - posting_at) return false;
+			s.file = std::make_shared<mapped_index_file>();
+			s.ranker = std::make_shared<search_ranker>(make_ranker());
+			s.idf = next->idf;
+			if (!s.file->open(segment_path(s.number), fingerprint_) || !s.ranker->load(*s.file) ||
+				!s.ranker->view_scores(idf, terms, norms + s.base, removed + s.base, s.count,
+					block_max + block_at, segment_blocks, max_impact + impact_at, segment_terms,
+					impacts + posting_at, segment_postings)) return false;
+			block_at += segment_blocks;
+			impact_at += segment_terms;
+			posting_at += segment_postings;
+			next_number = std::max(next_number, s.number + 1);
+			next->segments.push_back(std::move(s));
+		}
+		const size_t covered = next->segments.empty() ? 0 : next->segments.back().base + next->segments.back().count;
+		if (covered != documents || block_at != blocks || impact_at != impact_terms || posting_at != postings) return false;
+
+		// files the index does not list, left by a crash, are dropped with
+		// the next save; new segments are numbered past all of them
+		std::vector<uint32_t> unlisted;
+		for (uint32_t number : segment_files()) {
+			next_number = std::max(next_number, number + 1);
+			bool listed = false;
+			for (const auto& s : next->segments) listed = listed || s.number == number;
+			if (!listed) unlisted.push_back(number);
+		}
+
+		std::lock_guard<std::mutex> guard(lock_);
+		df_ = next->df;
+		removed_ = next->removed;
+		live_documents_ = (size_t)std::count(removed_.begin(), removed_.end(), 0);
+		total_length_ = *total_length;
+		pending_.clear();
+		newly_removed_.clear();
+		drift_ = 0;
+		memtable_documents_ = 0;
+		next_number_ = next_number;
+		obsolete_.insert(obsolete_.end(), unlisted.begin(), unlisted.end());
+		current_ = next;
+		published_ = submitted_;
+		return true;
+	}
+};
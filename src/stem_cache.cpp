@@ -0,0 +1,117 @@
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "stemmer.cpp"
+
+#define STEM_CACHE_SHARDS 64
+#define STEM_CACHE_SLOTS 1024
+// words of up to STEM_CACHE_WORD - 1 characters are cached
+#define STEM_CACHE_WORD 24
+
+struct stem_cache_stats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	// words too long to be cached
+	uint64_t uncached = 0;
+
+	double hit_rate() const {
+		const uint64_t lookups = hits + misses + uncached;
+		return lookups == 0 ? 0.0 : (double)hits / lookups;
+	}
+};
+
+// Bounded word -> stem memo shared by all ingestion threads. Words hash to
+// one of STEM_CACHE_SHARDS shards, each with its own lock and a
+// direct-mapped array of fixed-size slots, so lookups never allocate and
+// threads only contend when they hit the same shard. A miss stems outside
+// the lock and then overwrites whatever the slot held.
+class stem_cache {
+private:
+	struct slot {
+		uint8_t word_length = 0;
+		uint8_t stem_length = 0;
+		char word[STEM_CACHE_WORD];
+		char stem[STEM_CACHE_WORD];
+	};
+
+	struct shard {
+		std::mutex lock;
+		slot slots[STEM_CACHE_SLOTS];
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t uncached = 0;
+	};
+
+	std::unique_ptr<shard[]> shards_;
+
+	static uint64_t hash(const char* w, size_t n) {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)w[i]) * 0x100000001b3ull;
+		return h;
+	}
+public:
+	stem_cache() : shards_(new shard[STEM_CACHE_SHARDS]) {}
+
+	// same contract as porter::stem: stems the n characters at w in place,
+	// w has room for n + 1 characters
+	size_t stem(char* w, size_t n) {
+		const uint64_t h = hash(w, n);
+		shard& s = shards_[h % STEM_CACHE_SHARDS];
+		if (n == 0 || n >= STEM_CACHE_WORD) {
+			{
+				std::lock_guard<std::mutex> guard(s.lock);
+				s.uncached += 1;
+			}
+			return porter::stem(w, n);
+		}
+
+		slot& e = s.slots[(h / STEM_CACHE_SHARDS) % STEM_CACHE_SLOTS];
+		{
+			std::lock_guard<std::mutex> guard(s.lock);
+			if (e.word_length == n && std::memcmp(e.word, w, n) == 0) {
+				s.hits += 1;
+				std::memcpy(w, e.stem, e.stem_length);
+				return e.stem_length;
+			}
+			s.misses += 1;
+		}
+
+		char word[STEM_CACHE_WORD];
+		std::memcpy(word, w, n);
+		const size_t length = porter::stem(w, n);
+
+		std::lock_guard<std::mutex> guard(s.lock);
+		e.word_length = (uint8_t)n;
+		e.stem_length = (uint8_t)length;
+		std::memcpy(e.word, word, n);
+		std::memcpy(e.stem, w, length);
+		return length;
+	}
+
+	stem_cache_stats stats() const {
+		stem_cache_stats total;
+		for (size_t i = 0; i < STEM_CACHE_SHARDS; ++i) {
+			std::lock_guard<std::mutex> guard(shards_[i].lock);
+			total.hits += shards_[i].hits;
+			total.misses += shards_[i].misses;
+			total.uncached += shards_[i].uncached;
+		}
+		return total;
+	}
+
+	void reset_stats() {
+		for (size_t i = 0; i < STEM_CACHE_SHARDS; ++i) {
+			std::lock_guard<std::mutex> guard(shards_[i].lock);
+			shards_[i].hits = shards_[i].misses = shards_[i].uncached = 0;
+		}
+	}
+
+	size_t get_bytes_count() const { return sizeof(*this) + STEM_CACHE_SHARDS * sizeof(shard); }
+};
+
+// the cache used by stem_tokens()
+static stem_cache& shared_stem_cache() {
+	static stem_cache cache;
+	return cache;
+}
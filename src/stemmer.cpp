@@ -1,63 +1,120 @@
 #include <string>
 #include <vector>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+
+// One suffix rule: a word ending in suffix gets it replaced by replacement.
+struct suffix_rule {
+	const char* suffix;
+	size_t length;
+	const char* replacement;
+	size_t replacement_length;
+};
+
+constexpr size_t cstr_length(const char* s) {
+	size_t n = 0;
+	while (s[n] != '\0') ++n;
+	return n;
+}
+
+constexpr suffix_rule rule(const char* suffix, const char* replacement = "") {
+	return { suffix, cstr_length(suffix), replacement, cstr_length(replacement) };
+}
+
+// A suffix table regrouped at compile time by the suffix's last letter, so
+// a lookup only compares the few rules that end like the word does. Within
+// a group the table order is kept, so the first match is the same rule a
+// scan of the whole table would find.
+template <size_t N>
+struct suffix_dispatch {
+	suffix_rule rules[N];
+	// rules ending in letter c are rules[begin[c] .. begin[c + 1]]
+	uint8_t begin[27];
+
+	constexpr suffix_dispatch(const suffix_rule (&table)[N]) : rules(), begin() {
+		for (size_t i = 0; i < N; ++i) begin[table[i].suffix[table[i].length - 1] - 'a' + 1] += 1;
+		for (size_t c = 0; c < 26; ++c) begin[c + 1] += begin[c];
+		uint8_t fill[26] = {};
+		for (size_t c = 0; c < 26; ++c) fill[c] = begin[c];
+		for (size_t i = 0; i < N; ++i) rules[fill[table[i].suffix[table[i].length - 1] - 'a']++] = table[i];
+	}
 
-using suff_table_t = std::vector<std::pair<std::string, std::string>>;
+	// first rule of the table whose suffix ends the n characters at w
+	const suffix_rule* match(const char* w, size_t n) const {
+		if (n == 0 || w[n - 1] < 'a' || w[n - 1] > 'z') return nullptr;
+		const size_t c = w[n - 1] - 'a';
+		for (size_t i = begin[c]; i < begin[c + 1]; ++i) {
+			const suffix_rule& r = rules[i];
+			if (r.length <= n && std::memcmp(w + n - r.length, r.suffix, r.length - 1) == 0) return &r;
+		}
+		return nullptr;
+	}
+};
 
-const suff_table_t shrink_table_1 = {
-	{"ational","ate"},{"tional","tion"},{"enci","ence"},{"anci","ance"},
-	{"izer","ize"},{"abli","able"},{"alli","al"},{"entli","ent"},
-	{"eli","e"},{"ousli","ous"},{"ization","ize"},{"ation","ate"},
-	{"ator","ate"},{"alism","al"},{"iveness","ive"},{"fulness","ful"},
-	{"ousness","ous"}
+constexpr suffix_rule shrink_rules_1[] = {
+	rule("ational","ate"),rule("tional","tion"),rule("enci","ence"),rule("anci","ance"),
+	rule("izer","ize"),rule("abli","able"),rule("alli","al"),rule("entli","ent"),
+	rule("eli","e"),rule("ousli","ous"),rule("ization","ize"),rule("ation","ate"),
+	rule("ator","ate"),rule("alism","al"),rule("iveness","ive"),rule("fulness","ful"),
+	rule("ousness","ous")
 };
 
-const suff_table_t shrink_table_2 = {
-	{"icate","ic"},{"ative",""},{"alize","al"},{"iciti","ic"},
-	{"ical","ic"},{"ful",""},{"ness",""}
+constexpr suffix_rule shrink_rules_2[] = {
+	rule("icate","ic"),rule("ative"),rule("alize","al"),rule("iciti","ic"),
+	rule("ical","ic"),rule("ful"),rule("ness")
 };
 
-const std::vector<std::string> suff_table = {
-	"al","ance","ence","er","ic","able","ible","ant","ement",
-	"ment","ent","ism","ate","iti","ous","ive","ize"
+constexpr suffix_rule suff_rules[] = {
+	rule("al"),rule("ance"),rule("ence"),rule("er"),rule("ic"),rule("able"),rule("ible"),rule("ant"),rule("ement"),
+	rule("ment"),rule("ent"),rule("ism"),rule("ate"),rule("iti"),rule("ous"),rule("ive"),rule("ize")
 };
 
+constexpr suffix_dispatch<sizeof(shrink_rules_1) / sizeof(suffix_rule)> shrink_table_1(shrink_rules_1);
+constexpr suffix_dispatch<sizeof(shrink_rules_2) / sizeof(suffix_rule)> shrink_table_2(shrink_rules_2);
+constexpr suffix_dispatch<sizeof(suff_rules) / sizeof(suffix_rule)> suff_table(suff_rules);
+
 namespace porter
 {
-	std::string get_only_letters(const std::string& s) {
-		std::string out;
-		out.reserve(s.size());
-		for (char ch : s) {
+	// Every helper works on the first n characters of a caller-owned buffer,
+	// nothing below allocates.
+
+	// keeps only the letters of w, lower-cased, returns how many are left
+	size_t keep_only_letters(char* w, size_t n) {
+		size_t out = 0;
+		for (size_t i = 0; i < n; ++i) {
+			char ch = w[i];
 			if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) {
-				out.push_back(std::tolower((unsigned char)ch));
+				w[out++] = std::tolower((unsigned char)ch);
 			}
 		}
 		return out;
 	}
 
-	bool is_vowel(const std::string& word, int i) {
-		char ch = word[i];
+	bool is_vowel(const char* w, int i) {
+		char ch = w[i];
 		if (ch == 'a' || ch == 'e' || ch == 'i' || ch == 'o' || ch == 'u') {
 			return true;
 		}
 		if (ch == 'y') {
 			if (i == 0) return false;
-			return !is_vowel(word, i - 1);
+			return !is_vowel(w, i - 1);
 		}
 		return false;
 	}
 
-	bool contains_vowel(const std::string& word) {
-		for (int i = 0; i < (int)word.size(); ++i) {
-			if (is_vowel(word, i)) return true;
+	bool contains_vowel(const char* w, size_t n) {
+		for (int i = 0; i < (int)n; ++i) {
+			if (is_vowel(w, i)) return true;
 		}
 		return false;
 	}
 
-	int vc_count(const std::string& word) {
+	int vc_count(const char* w, size_t n) {
 		int vc_count = 0;
 		bool prev_was_vowel = false;
-		for (int i = 0; i < (int)word.size(); ++i) {
-			bool curr_is_vowel = is_vowel(word, i);
+		for (int i = 0; i < (int)n; ++i) {
+			bool curr_is_vowel = is_vowel(w, i);
 			if (prev_was_vowel && !curr_is_vowel) {
 				++vc_count;
 			}
@@ -66,118 +123,113 @@ namespace porter
 		return vc_count;
 	}
 
-	bool cc_ending(const std::string& word) {
-		int word_size = (int)word.size();
-		if (word_size < 2) return false;
-		if (word[word_size - 1] != word[word_size - 2]) return false;
-		return !is_vowel(word, word_size - 1);
+	bool cc_ending(const char* w, size_t n) {
+		if (n < 2) return false;
+		if (w[n - 1] != w[n - 2]) return false;
+		return !is_vowel(w, (int)n - 1);
 	}
 
-	bool cvc_ending(const std::string& word) {
-		size_t word_size = word.size();
-		if (word_size < 3) return false;
-		bool front_c = !is_vowel(word, word_size - 3);
-		bool middle_v = is_vowel(word, word_size - 2);
-		bool back_c = !is_vowel(word, word_size - 1);
-		char last = word[word_size - 1];
+	bool cvc_ending(const char* w, size_t n) {
+		if (n < 3) return false;
+		bool front_c = !is_vowel(w, (int)n - 3);
+		bool middle_v = is_vowel(w, (int)n - 2);
+		bool back_c = !is_vowel(w, (int)n - 1);
+		char last = w[n - 1];
 		if (front_c && middle_v && back_c && last != 'w' && last != 'x' && last != 'y') return true;
 		return false;
 	}
 
-	bool suff_ending(const std::string& word, const std::string& suff) {
-		if ((int)word.size() < (int)suff.size()) return false;
-		return word.compare(word.size() - suff.size(), suff.size(), suff) == 0;
-	}
-
-	std::string erase_suffix(const std::string& word, int len) {
-		return word.substr(0, word.size() - len);
+	bool suff_ending(const char* w, size_t n, const char* suff, size_t len) {
+		if (n < len) return false;
+		return std::memcmp(w + n - len, suff, len) == 0;
 	}
 
-	void shrink_suff(std::string& word, const suff_table_t& table) {
-		for (auto& p : table) {
-			if (suff_ending(word, p.first)) {
-				std::string stem = erase_suffix(word, (int)p.first.size());
-				if (vc_count(stem) > 0)
-					word = stem + p.second;
-				return;
-			}
+	template <size_t N>
+	size_t shrink_suff(char* w, size_t n, const suffix_dispatch<N>& table) {
+		const suffix_rule* r = table.match(w, n);
+		if (r != nullptr && vc_count(w, n - r->length) > 0) {
+			std::memcpy(w + n - r->length, r->replacement, r->replacement_length);
+			n = n - r->length + r->replacement_length;
 		}
+		return n;
 	}
 
-	void modify_suff(std::string& word) {
-		shrink_suff(word, shrink_table_1);
-		shrink_suff(word, shrink_table_2);
+	size_t modify_suff(char* w, size_t n) {
+		n = shrink_suff(w, n, shrink_table_1);
+		return shrink_suff(w, n, shrink_table_2);
 	}
 
-	std::string get_stem(const std::string& input) {
-		std::string word = get_only_letters(input);
-		if ((int)word.size() <= 2)
-			return word;
-
-		if (suff_ending(word, "sses"))
-			word = erase_suffix(word, 2);
-		else if (suff_ending(word, "ies"))
-			word = erase_suffix(word, 3) + "i";
-		else if (suff_ending(word, "s") && word.size() >= 2 && word[word.size() - 2] != 's')
-			word = erase_suffix(word, 1);
-
-		int end_length = 0;
-		if (suff_ending(word, "ed"))
+	// Stems the n characters at w in place and returns the stem's length.
+	// The stem can be one character longer than the input (e.g. "bled"
+	// becomes "blede"), so w must have room for n + 1 characters.
+	size_t stem(char* w, size_t n) {
+		n = keep_only_letters(w, n);
+		if (n <= 2)
+			return n;
+
+		if (suff_ending(w, n, "sses", 4))
+			n -= 2;
+		else if (suff_ending(w, n, "ies", 3))
+			n -= 2;
+		else if (suff_ending(w, n, "s", 1) && n >= 2 && w[n - 2] != 's')
+			n -= 1;
+
+		size_t end_length = 0;
+		if (suff_ending(w, n, "ed", 2))
 			end_length = 2;
-		else if (suff_ending(word, "ing"))
+		else if (suff_ending(w, n, "ing", 3))
 			end_length = 3;
 
-		std::string base = erase_suffix(word, end_length);
-		if (contains_vowel(base))
-			word = base;
+		if (contains_vowel(w, n - end_length))
+			n -= end_length;
 
 		if (end_length != 0) {
-			if (suff_ending(word, "at") || suff_ending(word, "bl") || suff_ending(word, "iz"))
-				word.push_back('e');
-			else if (cc_ending(word)) {
-				char last = word.back();
+			if (suff_ending(w, n, "at", 2) || suff_ending(w, n, "bl", 2) || suff_ending(w, n, "iz", 2))
+				w[n++] = 'e';
+			else if (cc_ending(w, n)) {
+				char last = w[n - 1];
 				if (last != 'l' && last != 's' && last != 'z')
-					word.pop_back();
+					n -= 1;
 			}
-			else if (vc_count(word) == 1 && cvc_ending(word))
-				word.push_back('e');
+			else if (vc_count(w, n) == 1 && cvc_ending(w, n))
+				w[n++] = 'e';
 		}
-		if (suff_ending(word, "y")) {
-			if (word.size() >= 2 && is_vowel(word, (int)word.size() - 2))
-				word.back() = 'i';
+		if (suff_ending(w, n, "y", 1)) {
+			if (n >= 2 && is_vowel(w, (int)n - 2))
+				w[n - 1] = 'i';
 		}
 
-		modify_suff(word);
+		n = modify_suff(w, n);
 
-		size_t match_at = -1;
-		for (size_t i = 0; i < suff_table.size(); i++) {
-			if (suff_ending(word, suff_table[i])) {
-				match_at = i;
-				break;
-			}
+		const suffix_rule* match = suff_table.match(w, n);
+		if (match != nullptr) {
+			size_t stem_length = n - match->length;
+			if (vc_count(w, stem_length) > 1)
+				n = stem_length;
 		}
-		if (match_at != -1) {
-			std::string stem = erase_suffix(word, (int)suff_table[match_at].size());
-			if (vc_count(stem) > 1)
-				word = stem;
-		}
-		else if (suff_ending(word, "ion")) {
-			std::string stem = erase_suffix(word, 3);
-			if (!stem.empty()) {
-				char ch = stem.back();
-				if ((ch == 's' || ch == 't') && vc_count(stem) > 1)
-					word = stem;
+		else if (suff_ending(w, n, "ion", 3)) {
+			size_t stem_length = n - 3;
+			if (stem_length != 0) {
+				char ch = w[stem_length - 1];
+				if ((ch == 's' || ch == 't') && vc_count(w, stem_length) > 1)
+					n = stem_length;
 			}
 		}
-		if (suff_ending(word, "e")) {
-			std::string stem = erase_suffix(word, 1);
-			int vc_cnt = vc_count(stem);
-			if (vc_cnt > 1 || (vc_cnt == 1 && !cvc_ending(stem)))
-				word = stem;
+		if (suff_ending(w, n, "e", 1)) {
+			int vc_cnt = vc_count(w, n - 1);
+			if (vc_cnt > 1 || (vc_cnt == 1 && !cvc_ending(w, n - 1)))
+				n -= 1;
 		}
-		if (suff_ending(word, "ll") && vc_count(erase_suffix(word, 1)) > 1)
-			word.pop_back();
+		if (suff_ending(w, n, "ll", 2) && vc_count(w, n - 1) > 1)
+			n -= 1;
+
+		return n;
+	}
 
+	std::string get_stem(const std::string& input) {
+		std::string word(input.size() + 1, '\0');
+		std::memcpy(&word[0], input.data(), input.size());
+		word.resize(stem(&word[0], input.size()));
 		return word;
 	}
 };
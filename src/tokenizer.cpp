@@ -1,5 +1,12 @@
-#include "stemmer.cpp"
-#include "trie.cpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cctype>
+#include "stem_cache.cpp"
+#include "scanner.cpp"
+
+// memoize stems in shared_stem_cache() instead of stemming every token
+#define STEM_CACHE
 
 std::vector<std::string> tokenize(const std::string& text) {
 	std::vector<std::string> tokens;
@@ -23,17 +30,49 @@ std::vector<std::string> tokenize(const std::string& text) {
 	return tokens;
 }
 
-std::vector<std::string> stem_tokens(const std::vector<std::string>& tokens) {
-	std::vector<std::string> out;
-	out.reserve(tokens.size());
-	for (auto const& t : tokens) {
-		std::string s = porter::get_stem(t);
-		if (!s.empty()) out.push_back(std::move(s));
+static inline size_t stem_in_place(char* w, size_t n) {
+	#ifdef STEM_CACHE
+	return shared_stem_cache().stem(w, n);
+	#else
+	return porter::stem(w, n);
+	#endif
+}
+
+// stems every token in place, tokens left empty are dropped
+std::vector<std::string> stem_tokens(std::vector<std::string> tokens) {
+	size_t kept = 0;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		std::string& t = tokens[i];
+		const size_t n = t.size();
+		// room for a stem one character longer than the token
+		t.push_back('\0');
+		t.resize(stem_in_place(&t[0], n));
+		if (t.empty()) continue;
+		if (kept != i) tokens[kept] = std::move(t);
+		++kept;
 	}
-	return out;
+	tokens.resize(kept);
+	return tokens;
+}
+
+// Tokenizes and stems in one pass: each token is lower-cased into a
+// per-thread scratch buffer by the fastest scanner the CPU supports,
+// stemmed there and handed to sink(term, offset) as a string_view that is
+// only valid during the call, with the byte offset of the token in text.
+// Yields the same terms, in the same order, as stem_tokens(tokenize(text))
+// without allocating per token.
+template <class sink_fn>
+void for_each_term(const char* text, size_t length, sink_fn sink) {
+	thread_local std::string scratch(64, '\0');
+	for_each_token(text, length, best_scanner(), scratch, [&](char* token, size_t n, size_t offset) {
+		const size_t stem_length = stem_in_place(token, n);
+		if (stem_length != 0) sink(std::string_view(token, stem_length), offset);
+	});
 }
 
 std::vector<std::string> get_tokens(const std::string& text) {
-	auto toks = tokenize(text);
-	return stem_tokens(toks);
+	std::vector<std::string> terms;
+	terms.reserve(128);
+	for_each_term(text.data(), text.size(), [&](std::string_view term, size_t) { terms.emplace_back(term); });
+	return terms;
 }
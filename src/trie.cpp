@@ -1,29 +1,32 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
 
 #define TRIE
 #define UNIT_TESTS
 #define CH_SIZE  26
+#define TRIE_NIL 0u
 
+// Nodes are stored in one contiguous slab owned by the trie, children are
+// 32-bit slab indices. Slot 0 is always the root, so no node can have it as
+// a child and TRIE_NIL doubles as "no child". id is a free payload slot for
+// owners that attach data to terms (see term_dictionary).
 struct trie_node {
-    trie_node* ch[CH_SIZE];
+    uint32_t ch[CH_SIZE];
+    uint32_t count = 0;
+    uint32_t id = 0;
     bool is_term = false;
-    size_t count = 0;
 
     trie_node() {
         for(int i = 0; i < CH_SIZE; i++) {
-            ch[i] = nullptr;
+            ch[i] = TRIE_NIL;
         }
     }
 
-    bool is_leaf() {
-        if (this == nullptr) {
-            return true;
-        }
-
+    bool is_leaf() const {
         for (size_t i = 0; i < CH_SIZE; i++) {
-            if (this->ch[i] != nullptr) {
+            if (this->ch[i] != TRIE_NIL) {
                 return false;
             }
         }
@@ -34,141 +37,143 @@ struct trie_node {
 
 class trie {
 private:
-    trie_node* root = nullptr;
-    size_t ch_count = 0;
-
-    inline size_t get_index(char& sym) const { return (unsigned int)sym % (unsigned int)'a'; }
-
-    trie_node* _find(trie_node* root, std::string& stem, size_t i) const {
-        if (root == nullptr) {
-            return nullptr;
-        }
+    std::vector<trie_node> nodes;
+    std::vector<uint32_t> free_nodes;
 
-        if (i >= stem.size()) {
-            return root;
-        }
+    inline size_t get_index(char sym) const { return (unsigned char)sym - (unsigned char)'a'; }
 
-        if (root->ch[get_index(stem[i])] != nullptr) {
-            return _find(root->ch[get_index(stem[i])], stem, i + 1);
+    uint32_t _alloc_node() {
+        if (!free_nodes.empty()) {
+            uint32_t idx = free_nodes.back();
+            free_nodes.pop_back();
+            nodes[idx] = trie_node();
+            return idx;
         }
 
-        return nullptr;
+        nodes.emplace_back();
+        return (uint32_t)(nodes.size() - 1);
     }
 
-    void _insert(trie_node* root, std::string& stem, size_t i) {
-        if (root == nullptr) {
-            return;
+    void _ensure_root() {
+        if (nodes.empty()) {
+            nodes.emplace_back();
         }
+    }
 
-        if(i == stem.size()) {
-            root->count += 1;
-            root->is_term = true;
-            return;
+    uint32_t _find(const std::string& stem) const {
+        if (nodes.empty()) {
+            return TRIE_NIL;
         }
 
-        if (root->ch[get_index(stem[i])] != nullptr) {
-            _insert(root->ch[get_index(stem[i])], stem, i + 1);
-        }
-        else {
-            if (root == this->root) {
-                ch_count += 1;
+        uint32_t cur = 0;
+        for (size_t i = 0; i < stem.size(); i++) {
+            cur = nodes[cur].ch[get_index(stem[i])];
+            if (cur == TRIE_NIL) {
+                return TRIE_NIL;
             }
-            _push_prefix(root, stem, i);
         }
-    }
 
-    void _erase(trie_node* root, std::string& stem, size_t i) {
-        if (root == nullptr) {
-            return;
-        }
+        return cur;
+    }
 
-        if (i == stem.size()) {
-            root->count -= 1;
-            if(root->count == 0) {
-                root->is_term = false;
-            }
-            return;
-        }
+    uint32_t _insert(const std::string& stem) {
+        _ensure_root();
 
-        if (root->ch[get_index(stem[i])] != nullptr) {
-            _erase(root->ch[get_index(stem[i])], stem, i + 1);
-            if (root->ch[get_index(stem[i])]->is_leaf() == true) {
-                delete root->ch[i];
-                root->ch[get_index(stem[i])] = nullptr;
+        uint32_t cur = 0;
+        for (size_t i = 0; i < stem.size(); i++) {
+            size_t c = get_index(stem[i]);
+            uint32_t next = nodes[cur].ch[c];
+            if (next == TRIE_NIL) {
+                // _alloc_node may grow the slab, so re-index after it
+                next = _alloc_node();
+                nodes[cur].ch[c] = next;
             }
+            cur = next;
         }
 
+        nodes[cur].count += 1;
+        nodes[cur].is_term = true;
+        return cur;
     }
 
-    void _push_prefix(trie_node* st_node, std::string& stem, size_t st) {
-        if (st == stem.size()) {
-            st_node->count += 1;
-            st_node->is_term = true;
+    void _erase(const std::string& stem) {
+        if (nodes.empty()) {
             return;
         }
 
-        st_node->ch[get_index(stem[st])] = new trie_node;
-        _push_prefix(st_node->ch[get_index(stem[st])], stem, st + 1);
-    }
+        std::vector<uint32_t> path;
+        path.reserve(stem.size() + 1);
+        path.push_back(0);
 
-    void _clear(trie_node* root) {
-        if (root == nullptr) {
+        for (size_t i = 0; i < stem.size(); i++) {
+            uint32_t next = nodes[path.back()].ch[get_index(stem[i])];
+            if (next == TRIE_NIL) {
+                return;
+            }
+            path.push_back(next);
+        }
+
+        trie_node& last = nodes[path.back()];
+        if (last.count == 0) {
             return;
         }
+        last.count -= 1;
+        if (last.count == 0) {
+            last.is_term = false;
+        }
 
-        for (size_t i = 0; i < CH_SIZE; i++) {
-            if (root->ch[i] != nullptr) {
-                _clear(root->ch[i]);
+        // prune the now useless tail of the branch, never the root
+        for (size_t i = stem.size(); i > 0; i--) {
+            uint32_t idx = path[i];
+            if (nodes[idx].is_term || !nodes[idx].is_leaf()) {
+                break;
             }
+            nodes[path[i - 1]].ch[get_index(stem[i - 1])] = TRIE_NIL;
+            free_nodes.push_back(idx);
         }
-
-        delete root;
-        root = nullptr;
     }
 
-    void traverse(std::unordered_map<std::string, int>& tf_map, trie_node* root, std::string& temp) const {
+    void traverse(std::unordered_map<std::string, int>& tf_map, uint32_t root, std::string& temp) const {
         for(size_t i = 0; i < CH_SIZE; i++) {
-            if(root->ch[i] != nullptr) {
+            uint32_t child = nodes[root].ch[i];
+            if(child != TRIE_NIL) {
                 temp += ('a' + i);
-                traverse(tf_map, root->ch[i], temp);
-                if(root->ch[i]->is_term == true) {
-                    tf_map.insert(std::make_pair(temp, (int)root->ch[i]->count));
+                traverse(tf_map, child, temp);
+                if(nodes[child].is_term == true) {
+                    tf_map.insert(std::make_pair(temp, (int)nodes[child].count));
                 }
                 temp.pop_back();
             }
         }
     }
-
-    void _get_bytes_count(trie_node* root, size_t& bytes) {
-        for(size_t i = 0; i < CH_SIZE; i++) {
-            if(root->ch[i] != nullptr) {
-                _get_bytes_count(root->ch[i], bytes);
-            }
-        }
-        bytes += sizeof(*root);
-    }
 public:
-    trie() { root = new trie_node; }
+    trie() { _ensure_root(); }
 
     trie(std::vector<std::string>& list) {
-        root = new trie_node;
+        _ensure_root();
 
-        for (auto s : list)
+        for (auto& s : list)
             insert(s);
     }
 
     ~trie() { clear(); }
 
-    trie_node* find(std::string& stem) const { return _find(root, stem, 0); }
+    const trie_node* find(const std::string& stem) const {
+        uint32_t idx = _find(stem);
+        if (idx == TRIE_NIL && (nodes.empty() || !stem.empty())) {
+            return nullptr;
+        }
+        return &nodes[idx];
+    }
 
-    void insert(std::string& stem) { _insert(root, stem, 0); }
+    trie_node* insert(const std::string& stem) { return &nodes[_insert(stem)]; }
 
-    void erase(std::string& stem) { _erase(root, stem, 0); }
+    void erase(const std::string& stem) { _erase(stem); }
 
-    bool empty() { return ch_count == 0; }
+    bool empty() const { return nodes.empty() || nodes[0].is_leaf(); }
 
-    bool contains(std::string& stem) {
-        trie_node* node = find(stem);
+    bool contains(const std::string& stem) const {
+        const trie_node* node = find(stem);
 
         if (node == nullptr) {
             return false;
@@ -178,8 +183,8 @@ public:
         }
     }
 
-    size_t count(std::string& stem) const {
-        trie_node* node = find(stem);
+    size_t count(const std::string& stem) const {
+        const trie_node* node = find(stem);
 
         if (node == nullptr) {
             return 0;
@@ -189,15 +194,11 @@ public:
         }
     }
 
-    size_t count(std::vector<std::string>& stems) const {
+    size_t count(const std::vector<std::string>& stems) const {
         size_t ans = 0;
-        trie_node* temp = nullptr;
 
         for (size_t i = 0; i < stems.size(); i++) {
-            temp = this->find(stems[i]);
-            if (temp != nullptr) {
-                ans += temp->count;
-            }
+            ans += count(stems[i]);
         }
 
         return ans;
@@ -205,19 +206,27 @@ public:
 
     std::unordered_map<std::string, int> get_tf_map() const {
         std::unordered_map<std::string, int> tf_map;
+        if (nodes.empty()) {
+            return tf_map;
+        }
         std::string temp = "";
-        traverse(tf_map, root, temp);
+        traverse(tf_map, 0, temp);
         return tf_map;
     }
 
+    // Drops the growth slack of the slab once no more inserts are expected.
+    void shrink_to_fit() { nodes.shrink_to_fit(); }
+
+    // Releases the whole slab at once instead of freeing node by node.
     void clear() {
-        _clear(root);
-        root = nullptr;
+        std::vector<trie_node>().swap(nodes);
+        std::vector<uint32_t>().swap(free_nodes);
     }
 
-    size_t get_bytes_count() {
+    size_t get_bytes_count() const {
         size_t bytes = 0;
-        _get_bytes_count(this->root, bytes);
+        bytes += nodes.capacity() * sizeof(trie_node);
+        bytes += free_nodes.capacity() * sizeof(uint32_t);
         bytes += sizeof(*this);
         return bytes;
     }